@@ -0,0 +1,261 @@
+/* Program to time the parts of the calculation done by metadata.e on a
+ * given network, and print the results as one line of CSV or one JSON
+ * object, for keeping track of performance.  The network is read from a
+ * GML file, a snapshot, or an edge list and metadata file, depending on
+ * the file names given.  See "make bench".
+ */
+
+/* Inclusions */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "sbm.h"
+#include "vecmath.h"
+
+/* Constants */
+
+#define CSV 0          // Output formats
+#define JSON 1
+
+
+/* Start counting the cache misses of this process and the threads it
+ * starts, using the processor's performance counters.  Returns a file
+ * descriptor for reading the count, or -1 if the counters aren't available,
+ * as in many virtual machines */
+
+int start_misses()
+{
+#ifdef __linux__
+  int fd;
+  struct perf_event_attr attr;
+
+  memset(&attr,0,sizeof(attr));
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.inherit = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  fd = syscall(SYS_perf_event_open,&attr,0,-1,-1,0);
+  if (fd>=0) {
+    ioctl(fd,PERF_EVENT_IOC_RESET,0);
+    ioctl(fd,PERF_EVENT_IOC_ENABLE,0);
+  }
+  return fd;
+#else
+  return -1;
+#endif
+}
+
+
+/* Stop counting and return the count, or -1 if there isn't one */
+
+long stop_misses(int fd)
+{
+  long long count=-1;
+
+  if (fd<0) return -1;
+#ifdef __linux__
+  ioctl(fd,PERF_EVENT_IOC_DISABLE,0);
+  if (read(fd,&count,sizeof(count))!=sizeof(count)) count = -1;
+#endif
+  close(fd);
+  return count;
+}
+
+
+/* Measure of how far apart the two ends of the edges are in memory: the
+ * mean difference between the numbers of the vertices at their ends */
+
+double edge_span(NETWORK *G)
+{
+  int u,i;
+  double sum=0.0;
+
+  for (u=0; u<G->nvertices; u++) {
+    for (i=0; i<G->vertex[u].degree; i++) {
+      sum += abs(G->vertex[u].edge[i].target-u);
+    }
+  }
+  return (G->nedges>0) ? sum/G->nedges : 0.0;
+}
+
+
+/* Return 1 if the string ends with the given suffix */
+
+int ends_with(char *s, char *suffix)
+{
+  int ls=strlen(s),lsuffix=strlen(suffix);
+
+  return (ls>=lsuffix)&&(strcmp(s+ls-lsuffix,suffix)==0);
+}
+
+
+void main(int argc, char *argv[])
+{
+  int k=2;               // Number of groups
+  int threads=1;         // Number of threads
+  int opt;
+  int format=CSV;
+  int header=0;          // Set to print the CSV header line first
+  int simd=VM_AUTO;
+  int schedule=SBM_FLOOD;
+  int precision=SBM_DOUBLE;
+  int ordering=SBM_ORDER_NONE;
+  int status;
+  int fd;
+  long misses;
+  unsigned long seed=1;
+  char *name=NULL;       // Name for the network in the output
+  char *file;
+  SBM *sbm;
+  SBM_STATS stats;
+  FILE *stream;
+  static char *names[] = { "double", "float", "bfloat16" };
+  static char *orders[] = { "none", "degree", "bfs", "rcm" };
+  static struct option options[] = {
+    { "groups", required_argument, NULL, 'k' },
+    { "seed", required_argument, NULL, 's' },
+    { "schedule", required_argument, NULL, 'b' },
+    { "simd", required_argument, NULL, 'm' },
+    { "precision", required_argument, NULL, 'P' },
+    { "reorder", required_argument, NULL, 'r' },
+    { "name", required_argument, NULL, 'N' },
+    { "json", no_argument, NULL, 'j' },
+    { "header", no_argument, NULL, 'H' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // Read the command line
+
+  while ((opt=getopt_long(argc,argv,"k:s:b:m:P:r:N:jH",options,NULL))!=-1) {
+    switch (opt) {
+    case 'k':
+      k = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg,NULL,10);
+      break;
+    case 'b':
+      if (strcmp(optarg,"flood")==0) schedule = SBM_FLOOD;
+      else if (strcmp(optarg,"residual")==0) schedule = SBM_RESIDUAL;
+      else k = 0;
+      break;
+    case 'm':
+      if (strcmp(optarg,"scalar")==0) simd = VM_SCALAR;
+      else if (strcmp(optarg,"avx2")==0) simd = VM_AVX2;
+      else if (strcmp(optarg,"avx512")==0) simd = VM_AVX512;
+      else k = 0;
+      break;
+    case 'P':
+      if (strcmp(optarg,"double")==0) precision = SBM_DOUBLE;
+      else if (strcmp(optarg,"float")==0) precision = SBM_FLOAT;
+      else if (strcmp(optarg,"bfloat16")==0) precision = SBM_BFLOAT16;
+      else k = 0;
+      break;
+    case 'r':
+      for (ordering=SBM_ORDER_RCM; ordering>=0; ordering--) {
+	if (strcmp(optarg,orders[ordering])==0) break;
+      }
+      if (ordering<0) k = 0;
+      break;
+    case 'N':
+      name = optarg;
+      break;
+    case 'j':
+      format = JSON;
+      break;
+    case 'H':
+      header = 1;
+      break;
+    default:
+      k = 0;
+    }
+  }
+  if ((k<1)||(argc-optind<1)||(argc-optind>2)) {
+    fprintf(stderr,"Usage: %s [-k groups] [-s seed] [-b flood|residual] "
+	    "[-m scalar|avx2|avx512] [-P double|float|bfloat16] "
+	    "[-r none|degree|bfs|rcm] [-N name] "
+	    "[-j] [-H] "
+	    "network.gml|network.snap|network.edges network.labels\n",argv[0]);
+    exit(1);
+  }
+  file = argv[optind];
+  if (name==NULL) name = file;
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  simd = vecmath_init(simd);
+
+  // Read the network
+
+  sbm = sbm_new();
+  sbm_set_groups(sbm,k);
+  sbm_set_schedule(sbm,schedule);
+  sbm_set_seed(sbm,seed);
+  sbm_set_precision(sbm,precision);
+  sbm_set_order(sbm,ordering);
+  if (argc-optind==2) {
+    status = sbm_read_edgelist(sbm,file,argv[optind+1]);
+  } else if (ends_with(file,".gml")) {
+    stream = fopen(file,"r");
+    if (stream==NULL) {
+      fprintf(stderr,"Can't open %s\n",file);
+      exit(2);
+    }
+    status = sbm_read_gml(sbm,stream);
+    fclose(stream);
+  } else status = sbm_read_snapshot(sbm,file);
+  if (status!=0) exit(2);
+
+  // Do the calculation
+
+  fd = start_misses();
+  if (sbm_run(sbm)!=0) exit(2);
+  misses = stop_misses(fd);
+  sbm_stats(sbm,&stats);
+
+  // Print the results
+
+  if (format==JSON) {
+    printf("{\"name\": \"%s\", \"vertices\": %i, \"edges\": %li, "
+	   "\"values\": %i, \"groups\": %i, \"threads\": %i, "
+	   "\"simd\": \"%s\", \"read\": %.6f, \"metadata\": %.6f, "
+	   "\"bp\": %.6f, \"params\": %.6f, \"run\": %.6f, "
+	   "\"emsteps\": %i, \"sweeps\": %li, \"updates\": %li, "
+	   "\"loglikelihood\": %.10g, \"precision\": \"%s\", "
+	   "\"order\": \"%s\", \"edgespan\": %.1f, \"cachemisses\": %li}\n",
+	   name,sbm_nvertices(sbm),sbm_network(sbm)->nedges/2,
+	   sbm_nvalues(sbm),k,threads,vecmath_name(simd),stats.tread,
+	   stats.tmetadata,stats.tbp,stats.tparams,stats.trun,stats.emsteps,
+	   stats.sweeps,stats.updates,stats.L,names[precision],
+	   orders[ordering],edge_span(sbm_network(sbm)),misses);
+  } else {
+    if (header) {
+      printf("name,vertices,edges,values,groups,threads,simd,read,"
+	     "metadata,bp,params,run,emsteps,sweeps,updates,loglikelihood,"
+	     "precision,order,edgespan,cachemisses\n");
+    }
+    printf("%s,%i,%li,%i,%i,%i,%s,%.6f,%.6f,%.6f,%.6f,%.6f,%i,%li,%li,"
+	   "%.10g,%s,%s,%.1f,%li\n",
+	   name,sbm_nvertices(sbm),sbm_network(sbm)->nedges/2,
+	   sbm_nvalues(sbm),k,threads,vecmath_name(simd),stats.tread,
+	   stats.tmetadata,stats.tbp,stats.tparams,stats.trun,stats.emsteps,
+	   stats.sweeps,stats.updates,stats.L,names[precision],
+	   orders[ordering],edge_span(sbm_network(sbm)),misses);
+  }
+
+  sbm_free(sbm);
+}
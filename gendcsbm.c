@@ -0,0 +1,286 @@
+/* Program to generate networks from the degree-corrected stochastic block
+ * model, with categorical metadata correlated with the groups, for testing
+ * and timing metadata.e on networks of any size
+ *
+ * Each vertex is put in one of K groups at random and given a degree
+ * parameter theta drawn from a power law with exponent alpha (or theta=1
+ * for all vertices if alpha is zero).  Each edge is then made by choosing
+ * one end in proportion to theta, and the other in proportion to theta
+ * either from the same group, with probability p, or from the whole
+ * network, with probability 1-p.  Vertex degrees are thus proportional to
+ * theta on average.  Self-edges are not allowed, but multiedges are.
+ *
+ * The metadata take M values, which are divided among the groups, with
+ * value i belonging to group i mod K.  With probability rho a vertex gets
+ * one of the values belonging to its group, chosen at random, and
+ * otherwise a value chosen at random from all M.
+ *
+ * The network is written as a GML file prefix.gml, or as an edge list and
+ * metadata file prefix.edges and prefix.labels, as read by metadata.e with
+ * the -e and -l options.  The groups are written to prefix.groups.
+ */
+
+/* Inclusions */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <getopt.h>
+#include <gsl/gsl_rng.h>
+
+/* Constants */
+
+#define NDEFAULT 10000 // Default number of vertices
+#define CDEFAULT 10.0  // Default mean degree
+#define KDEFAULT 2     // Default number of groups
+#define ALPHA 2.5      // Default exponent of the degree distribution
+#define PIN 0.8        // Default fraction of edges within groups
+#define RHO 0.8        // Default correlation of metadata and groups
+
+#define GML 0          // Output formats
+#define EDGES 1
+
+/* Globals */
+
+int n;                 // Number of vertices
+int K;                 // Number of groups
+int M;                 // Number of metadata values
+int *g;                // Group of each vertex
+int *x;                // Metadata value of each vertex
+double *theta;         // Degree parameter of each vertex
+
+int *gvertex;          // Vertices in order of their groups
+int *gstart;           // Start of each group in gvertex[], plus one at the end
+double *cumul;         // Cumulative sums of theta in the order of gvertex[]
+
+gsl_rng *rng;          // Random number generator
+
+
+/* Make the groups, the degree parameters, and the metadata */
+
+void make_vertices(double alpha, double rho)
+{
+  int u,r;
+  int nvalues;
+
+  g = malloc(n*sizeof(int));
+  x = malloc(n*sizeof(int));
+  theta = malloc(n*sizeof(double));
+
+  for (u=0; u<n; u++) {
+    g[u] = gsl_rng_uniform_int(rng,K);
+
+    // Draw theta from a power law with minimum value 1, capped at n so
+    // that very heavy tails don't give vertices more edges than can exist
+
+    if (alpha>1.0) {
+      theta[u] = pow(1.0-gsl_rng_uniform(rng),-1.0/(alpha-1.0));
+      if (theta[u]>n) theta[u] = n;
+    } else theta[u] = 1.0;
+
+    // Choose the metadata value, either from those belonging to the
+    // vertex's group, which are r, r+K, r+2K, ..., or from all of them
+
+    r = g[u]%M;
+    nvalues = (M-r+K-1)/K;
+    if ((gsl_rng_uniform(rng)<rho)&&(nvalues>0)) {
+      x[u] = r + K*gsl_rng_uniform_int(rng,nvalues);
+    } else x[u] = gsl_rng_uniform_int(rng,M);
+  }
+}
+
+
+/* Put the vertices in order of their groups and make the cumulative sums
+ * of theta, so that vertices can be chosen in proportion to theta from
+ * the whole network or from a single group */
+
+void make_cumulative()
+{
+  int u,r;
+  double sum;
+
+  gstart = calloc(K+1,sizeof(int));
+  for (u=0; u<n; u++) gstart[g[u]+1]++;
+  for (r=0; r<K; r++) gstart[r+1] += gstart[r];
+
+  gvertex = malloc(n*sizeof(int));
+  for (u=n-1; u>=0; u--) gvertex[--gstart[g[u]+1]] = u;
+  for (u=0; u<n; u++) gstart[g[u]+1]++;
+
+  cumul = malloc(n*sizeof(double));
+  for (u=0,sum=0.0; u<n; u++) {
+    sum += theta[gvertex[u]];
+    cumul[u] = sum;
+  }
+}
+
+
+/* Choose a vertex in proportion to theta from positions start to end-1 in
+ * gvertex[], by binary search of the cumulative sums */
+
+int choose(int start, int end)
+{
+  int mid;
+  double low,target;
+
+  low = (start>0) ? cumul[start-1] : 0.0;
+  target = low + (cumul[end-1]-low)*gsl_rng_uniform(rng);
+  while (end-start>1) {
+    mid = (start+end)/2;
+    if (cumul[mid-1]>target) end = mid;
+    else start = mid;
+  }
+
+  return gvertex[start];
+}
+
+
+/* Open an output file called prefix.ext */
+
+FILE *open_output(char *prefix, char *ext)
+{
+  char *name;
+  FILE *stream;
+
+  name = malloc(strlen(prefix)+strlen(ext)+2);
+  sprintf(name,"%s.%s",prefix,ext);
+  stream = fopen(name,"w");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",name);
+    exit(2);
+  }
+  free(name);
+
+  return stream;
+}
+
+
+void main(int argc, char *argv[])
+{
+  int u,v;
+  int opt;
+  int format=GML;
+  long e,m;
+  double c=CDEFAULT;     // Mean degree
+  double alpha=ALPHA;
+  double p=PIN;
+  double rho=RHO;
+  unsigned long seed;
+  char *prefix=NULL;
+  FILE *out,*labels;
+  static struct option options[] = {
+    { "vertices", required_argument, NULL, 'n' },
+    { "degree", required_argument, NULL, 'c' },
+    { "groups", required_argument, NULL, 'k' },
+    { "values", required_argument, NULL, 'm' },
+    { "exponent", required_argument, NULL, 'a' },
+    { "within", required_argument, NULL, 'p' },
+    { "correlation", required_argument, NULL, 'r' },
+    { "seed", required_argument, NULL, 's' },
+    { "format", required_argument, NULL, 'f' },
+    { "output", required_argument, NULL, 'o' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // Read the command line
+
+  n = NDEFAULT;
+  K = KDEFAULT;
+  M = 0;
+  seed = time(NULL);
+  while ((opt=getopt_long(argc,argv,"n:c:k:m:a:p:r:s:f:o:",options,NULL))
+	 !=-1) {
+    switch (opt) {
+    case 'n':
+      n = atoi(optarg);
+      break;
+    case 'c':
+      c = atof(optarg);
+      break;
+    case 'k':
+      K = atoi(optarg);
+      break;
+    case 'm':
+      M = atoi(optarg);
+      break;
+    case 'a':
+      alpha = atof(optarg);
+      break;
+    case 'p':
+      p = atof(optarg);
+      break;
+    case 'r':
+      rho = atof(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg,NULL,10);
+      break;
+    case 'f':
+      if (strcmp(optarg,"gml")==0) format = GML;
+      else if (strcmp(optarg,"edges")==0) format = EDGES;
+      else n = 0;
+      break;
+    case 'o':
+      prefix = optarg;
+      break;
+    default:
+      n = 0;
+    }
+  }
+  if (M==0) M = K;
+  if ((n<2)||(K<1)||(M<1)||(c<0.0)||(p<0.0)||(p>1.0)||(rho<0.0)||(rho>1.0)
+      ||((alpha!=0.0)&&(alpha<=1.0))||(prefix==NULL)||(optind<argc)) {
+    fprintf(stderr,"Usage: %s [-n vertices] [-c mean-degree] [-k groups] "
+	    "[-m values] [-a exponent] [-p within] [-r correlation] "
+	    "[-s seed] [-f gml|edges] -o prefix\n",argv[0]);
+    exit(1);
+  }
+
+  rng = gsl_rng_alloc(gsl_rng_mt19937);
+  gsl_rng_set(rng,seed);
+
+  make_vertices(alpha,rho);
+  make_cumulative();
+
+  // Write the vertices and their metadata
+
+  if (format==GML) {
+    out = open_output(prefix,"gml");
+    fprintf(out,"Creator \"gendcsbm -n %i -c %g -k %i -m %i -a %g -p %g "
+	    "-r %g -s %lu\"\ngraph\n[\n",n,c,K,M,alpha,p,rho,seed);
+    for (u=0; u<n; u++) {
+      fprintf(out,"  node\n  [\n    id %i\n    label \"Meta%i\"\n  ]\n",
+	      u,x[u]);
+    }
+  } else {
+    out = open_output(prefix,"edges");
+    labels = open_output(prefix,"labels");
+    for (u=0; u<n; u++) fprintf(labels,"%i Meta%i\n",u,x[u]);
+    fclose(labels);
+  }
+
+  // Make the edges and write them
+
+  m = (long)(0.5*n*c+0.5);
+  for (e=0; e<m; e++) {
+    u = choose(0,n);
+    do {
+      if ((gsl_rng_uniform(rng)<p)&&(gstart[g[u]+1]-gstart[g[u]]>1)) {
+	v = choose(gstart[g[u]],gstart[g[u]+1]);
+      } else v = choose(0,n);
+    } while (v==u);
+    if (format==GML) {
+      fprintf(out,"  edge\n  [\n    source %i\n    target %i\n  ]\n",u,v);
+    } else fprintf(out,"%i %i\n",u,v);
+  }
+  if (format==GML) fprintf(out,"]\n");
+  fclose(out);
+
+  // Write the groups
+
+  out = open_output(prefix,"groups");
+  for (u=0; u<n; u++) fprintf(out,"%i %i\n",u,g[u]);
+  fclose(out);
+}
@@ -1,530 +1,587 @@
 /* Program to perform K-group EM/BP community detection using the
  * degree-corrected SBM on an arbitrary network read from a GML file, with
- * discrete (categorical) metadata stored in the "label" field
+ * discrete (categorical) metadata stored in the "label" field.  The
+ * calculation itself is done by the library in sbm.c.
  *
  * Written by Mark Newman  28 NOV 2014
  */
 
-/* Program control */
-
-#define VERBOSE        // Set to print progress updates to stderr
-
 /* Inclusions */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <math.h>
+#include <ctype.h>
 #include <time.h>
-#include <gsl/gsl_rng.h>
-#include "readgml.h"
-
-/* Constants */
-
-#define K 2            // Number of groups
-
-#define BP_ACC 1e-4    // Required accuracy for BP to terminate
-#define EM_ACC 1e-4    // Required accuracy for EM to terminate
-
-#define NOCONVERGE     // Set to abort if the solution doesn't converge
-#define BP_MAXSTEP 20  // Maximum number of BP steps before aborting
-#define EM_MAXSTEP 100 // Maximum number of EM steps before aborting
-
-#define SMALL 1.0e-100
-
-/* Globals */
-
-NETWORK G;             // Struct storing the network
-int twom;              // Twice the number of edges
-
-int *x;                // Metadata
-int *nx;               // Number of nodes with each distinct metadata value
-double **nrx;          // Expected number in each group with value
-char **mlabel;         // Metadata strings
-int nmlabels;          // Number of distinct metadata strings
-
-double **gmma;         // Prior parameters (spelled "gmma" because "gamma"
-                       //   is a reserved word in C math.h)
-double omega[K][K];    // Mixing parameters
-
-double ***eta;         // Messages
-double **q;            // One-point marginals
-
-gsl_rng *rng;          // Random number generator
-
+#include <unistd.h>
+#include <getopt.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "sbm.h"
+#include "vecmath.h"
 
-/* Get metadata from the labels */
 
-#define MAXMETA 300
+/* Read a list of file names, one per line, skipping blank lines and lines
+ * starting with "#".  Returns the names, or NULL if the list can't be
+ * read */
 
-void get_metadata()
+char **read_list(char *listfile, int *n)
 {
-  int u,i;
-
-  /* Make space for the metadata numbers and labels */
-
-  x = malloc(G.nvertices*sizeof(int));
-  mlabel = malloc(MAXMETA*sizeof(char*));
-  nmlabels = 0;
-
-  /* Go through the vertices */
-
-  for (u=0; u<G.nvertices; u++) {
-
-    /* Check to see if this label is already in the list of labels */
-
-    for (i=0; i<nmlabels; i++) {
-      if (strcmp(G.vertex[u].label,mlabel[i])==0) break;
-    }
-
-    /* If not, add it */
+  int size=0;
+  ssize_t length;
+  size_t space=0;
+  char *line=NULL;
+  char **name=NULL;
+  FILE *stream;
+
+  stream = fopen(listfile,"r");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",listfile);
+    return NULL;
+  }
 
-    if (i==nmlabels) {
-      mlabel[nmlabels++] = G.vertex[u].label;  // Just set pointers equal
+  *n = 0;
+  while ((length=getline(&line,&space,stream))!=-1) {
+    while ((length>0)&&isspace(line[length-1])) line[--length] = '\0';
+    if ((length==0)||(line[0]=='#')) continue;
+    if (*n==size) {
+      size = (size==0) ? 1024 : 2*size;
+      name = realloc(name,size*sizeof(char*));
     }
-
-    /* Record this as the metadata type for this vertex */
-
-    x[u] = i;
+    name[(*n)++] = strdup(line);
   }
+  free(line);
+  fclose(stream);
 
-  /* Count how many nodes there are in each metadata group */
-
-  nx = calloc(nmlabels,sizeof(int));
-  for (u=0; u<G.nvertices; u++) nx[x[u]]++;
-
-#ifdef VERBOSE
-  fprintf(stderr,"Found %i distinct metadata values:\n",nmlabels);
-  for (i=0; i<nmlabels; i++) fprintf(stderr," %i %s\n",i,mlabel[i]);
-#endif
+  return name;
 }
 
 
-/* Function to generate d numbers at random that add up to unity */
+/* Read changes to the network from a file and queue them in the context,
+ * one to a line: "+ u v" to add an edge between vertices u and v, "- u v"
+ * to remove one, "= u label" to change the metadata of vertex u, and
+ * "* label" to add a vertex with the given metadata, which is numbered
+ * after all the others.  Vertices are numbered as in the output.  Blank
+ * lines and lines starting with "#" are skipped.  Returns the number of
+ * changes, or -1 on error */
 
-void random_unity(int d, double *x)
+int read_changes(SBM *sbm, char *deltafile)
 {
-  int k;
-  double sum=0.0;
-
-  for (k=0; k<d; k++) {
-    x[k] = gsl_rng_uniform(rng);
-    sum += x[k];
+  int n=0,line_number=0;
+  int u,v,pos;
+  int status;
+  ssize_t length;
+  size_t space=0;
+  char op;
+  char *line=NULL;
+  FILE *stream;
+
+  stream = fopen(deltafile,"r");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",deltafile);
+    return -1;
   }
-  for (k=0; k<d; k++) x[k] /= sum;
-}
-
-
-/* Do BP */
-
-int bp()
-{
-  int i,j;
-  int u,v;
-  int r,s;
-  int steps;
-  double deltaeta,maxdelta;
-  double logeta,neweta,sum,norm,largest;
-  double d[K];
-  double logpre[K];
-  double logqun[K];
-  double ***logetaun;
-
-  // Make space for the new log-etas, which are called "logetaun" because
-  // the are initially calculated in unnormalized form
-
-  logetaun = malloc(G.nvertices*sizeof(double**));
-  for (u=0; u<G.nvertices; u++) {
-    logetaun[u] = malloc(G.vertex[u].degree*sizeof(double*));
-    for (i=0; i<G.vertex[u].degree; i++) {
-      logetaun[u][i] = malloc(K*sizeof(double));
-    }
-  }
-
-  // Main BP loop
-
-  steps = 0;
-  do {
-
-    /* Calculate the expected group degrees */
-    
-    for (r=0; r<K; r++) {
-      d[r] = 0.0;
-      for (u=0; u<G.nvertices; u++) d[r] += q[u][r]*G.vertex[u].degree;
-    }
-  
-    /* Calculate the log-prefactors (without the leading factor of d_i or
-     * the prior) */
 
-    for (r=0; r<K; r++) {
-      logpre[r] = 0.0;
-      for (s=0; s<K; s++) logpre[r] -= omega[r][s]*d[s];
+  while ((length=getline(&line,&space,stream))!=-1) {
+    line_number++;
+    while ((length>0)&&isspace(line[length-1])) line[--length] = '\0';
+    if ((length==0)||(line[0]=='#')) continue;
+    status = 1;
+    pos = 0;
+    if ((sscanf(line," %c %i %i",&op,&u,&v)==3)&&((op=='+')||(op=='-'))) {
+      if (op=='+') status = sbm_add_edge(sbm,u,v);
+      else status = sbm_remove_edge(sbm,u,v);
+    } else if ((sscanf(line," = %i %n",&u,&pos)==1)&&(line[pos]!='\0')) {
+      status = sbm_change_label(sbm,u,line+pos);
+    } else if ((sscanf(line," * %n",&pos)==0)&&(pos>0)&&(line[pos]!='\0')) {
+      status = (sbm_add_vertex(sbm,line+pos)<0);
     }
-
-    /* Calculate new values for the one-vertex marginals */
-
-#ifdef VERBOSE
-    fprintf(stderr,"Calculating one-vertex marginals...    \r");
-#endif
-    for (u=0; u<G.nvertices; u++) {
-      for (r=0; r<K; r++) {
-	logqun[r] = log(gmma[r][x[u]]) + G.vertex[u].degree*logpre[r];
-	for (i=0; i<G.vertex[u].degree; i++) {
-	  sum = 0.0;
-	  for (s=0; s<K; s++) sum += eta[u][i][s]*omega[r][s];
-	  if (sum<SMALL) sum = SMALL;
-	  logqun[r] += log(sum);
-	}
-	if (r==0) largest = logqun[r];
-	else if (logqun[r]>largest) largest = logqun[r];
-      }
-
-      /* Normalize */
-
-      norm = 0.0;
-      for (r=0; r<K; r++) {
-	logqun[r] -= largest;
-	norm += exp(logqun[r]);
-      }
-      for (r=0; r<K; r++) q[u][r] = exp(logqun[r])/norm;
-    }
-
-    /* Calculate (unnormalized) new values for the (log) messages */
-
-#ifdef VERBOSE
-    fprintf(stderr,"Calculating messages...              \r");
-#endif
-    for (u=0; u<G.nvertices; u++) {
-      for (i=0; i<G.vertex[u].degree; i++) {
-	v = G.vertex[u].edge[i].target;
-	for (r=0; r<K; r++) {
-	  logeta = log(gmma[r][x[v]]) + G.vertex[v].degree*logpre[r];
-	  for (j=0; j<G.vertex[v].degree; j++) {
-	    if (G.vertex[v].edge[j].target!=u) {
-	      sum = 0.0;
-	      for (s=0; s<K; s++) sum += eta[v][j][s]*omega[r][s];
-	      if (sum<SMALL) sum = SMALL;   // Prevent -Inf
-	      logeta += log(sum);
-	    }
-	  }
-	  logetaun[u][i][r] = logeta;
-	}
-      }
-    }
-
-    /* Normalize and calculate largest change */
-
-#ifdef VERBOSE
-    fprintf(stderr,"Normalizing messages...\r");
-#endif
-    maxdelta = 0.0;
-    for (u=0; u<G.nvertices; u++) {
-      for (i=0; i<G.vertex[u].degree; i++) {
-	norm = 0.0;
-	largest = logetaun[u][i][0];
-	for (r=1; r<K; r++) {
-	  if (logetaun[u][i][r]>largest) largest = logetaun[u][i][r];
-	}
-	for (r=0; r<K; r++) {
-	  logetaun[u][i][r] -= largest;
-	  norm += exp(logetaun[u][i][r]);
-	}	  
-	for (r=0; r<K; r++) {
-	  neweta = exp(logetaun[u][i][r])/norm;
-	  deltaeta = fabs(neweta-eta[u][i][r]);
-	  if (deltaeta>maxdelta) maxdelta = deltaeta;
-	  eta[u][i][r] = neweta;
-	}
-      }
+    if (status!=0) {
+      fprintf(stderr,"Bad change on line %i of %s\n",line_number,deltafile);
+      n = -1;
+      break;
     }
-
-#ifdef VERBOSE
-    fprintf(stderr,"BP steps %i, max change = %g                   \r",
-	    steps,maxdelta);
-#endif
-
-  } while ((maxdelta>BP_ACC)&&(++steps<=BP_MAXSTEP));
-
-#ifdef VERBOSE
-  fprintf(stderr,"\n");
-#endif
-
-  // Free space
-
-  for (u=0; u<G.nvertices; u++) {
-   for (i=0; i<G.vertex[u].degree; i++) free(logetaun[u][i]);
-    free(logetaun[u]);
+    n++;
   }
-  free(logetaun);
+  free(line);
+  fclose(stream);
 
-  return steps;
+  return n;
 }
 
 
-// Function to calculate new values of the parameters
+/* Fit each of the networks in the GML files listed in listfile, and print
+ * the results, with each line starting with the name of the file the
+ * network came from.  The networks are fitted independently, as many at
+ * once as there are threads, each thread using one context for all the
+ * networks it fits.  A thread moves on to a new network as soon as the
+ * last one has converged, so that networks that take longer don't hold up
+ * the others.  Results are printed as each network finishes, so they are
+ * not in the order of the list.  Returns the number of networks that
+ * could not be fitted, or -1 if the list could not be read */
 
-double params()
+int batch(char *listfile, int k, int schedule, int nruns, unsigned long seed,
+	  int prune, int merge, int precision, int ordering, int verbose)
 {
-  int u,v;
-  int i,j;
-  int r,s;
-  double norm,esum,quvrs;
-  double d[K];
-  double term[K][K];
-  double sum[K][K];
-  double L;
-
-  // Calculate some basics
-
-  for (r=0; r<K; r++) {
-    d[r] = 0.0;
-    for (i=0; i<nmlabels; i++) nrx[r][i] = 0.0;
-  }
-
-  for (u=0; u<G.nvertices; u++) {
-    for (r=0; r<K; r++) {
-      d[r] += q[u][r]*G.vertex[u].degree;
-      nrx[r][x[u]] += q[u][r];
-    }
-  }
-
-  // Calculate new values of the gammas
-
-  for (r=0; r<K; r++) {
-    for (i=0; i<nmlabels; i++) gmma[r][i] = nrx[r][i]/nx[i];
-  }
-
-  // Calculate the new values of the omegas
-
-  // Zero out the sum variables
-
-  for (r=0; r<K; r++) {
-    for (s=0; s<K; s++) sum[r][s] = 0.0;
-  }
-  esum = 0.0;
-
-  // Perform the sums
-
-  for (u=0; u<G.nvertices; u++) {
-    for (i=0; i<G.vertex[u].degree; i++) {
-      v = G.vertex[u].edge[i].target;
-
-      // Find which edge leads back from v to u
+  int i;
+  int ngraphs;
+  int nfailed=0;
+  char **name;
+
+  name = read_list(listfile,&ngraphs);
+  if (name==NULL) return -1;
+  if (verbose) fprintf(stderr,"Fitting %i networks...\n",ngraphs);
+#ifdef _OPENMP
+  omp_set_max_active_levels(1);   // Each network is fitted on one thread
+#endif
 
-      for (j=0; j<G.vertex[v].degree; j++) {
-	if (G.vertex[v].edge[j].target==u) break;
+#pragma omp parallel
+  {
+    int u,r,failed;
+    char *buffer;
+    size_t size;
+    const double *q;
+    FILE *stream;
+    SBM *sbm;
+
+    sbm = sbm_new();
+    sbm_set_groups(sbm,k);
+    sbm_set_schedule(sbm,schedule);
+    sbm_set_restarts(sbm,nruns);
+    sbm_set_seed(sbm,seed);
+    sbm_set_prune(sbm,prune);
+    sbm_set_precision(sbm,precision);
+    sbm_set_order(sbm,ordering);
+
+#pragma omp for schedule(dynamic)
+    for (i=0; i<ngraphs; i++) {
+
+      // Read the network and fit it
+
+      stream = fopen(name[i],"r");
+      failed = (stream==NULL);
+      if (!failed) {
+	failed = (sbm_read_gml(sbm,stream)!=0);
+	fclose(stream);
       }
-      if (j==G.vertex[v].degree) {
-	fprintf(stderr,"Error!\n");
-	exit(23);
+      if (!failed) {
+	if (merge) sbm_merge(sbm);
+	failed = (sbm_run(sbm)!=0);
       }
-
-      // Calculate the terms and the normalization factor
-
-      norm = 0.0;
-      for (r=0; r<K; r++) {
-	for (s=0; s<K; s++) {
-	  term[r][s] = omega[r][s]*eta[u][i][r]*eta[v][j][s];
-	  norm += term[r][s];
-	}
+      if (failed) {
+	fprintf(stderr,"Failed to fit %s\n",name[i]);
+#pragma omp atomic
+	nfailed++;
+	continue;
       }
 
-      // Add to the running sums
+      // Print the results into a buffer, then print the buffer all at once,
+      // so that lines from different networks don't get mixed up
 
-      for (r=0; r<K; r++) {
-	for (s=0; s<K; s++) {
-	  quvrs = term[r][s]/norm;
-	  sum[r][s] += quvrs;
-	  esum += quvrs*log(quvrs);
-	}
+      stream = open_memstream(&buffer,&size);
+      q = sbm_marginals(sbm);
+      for (u=0; u<sbm_nvertices(sbm); u++) {
+	fprintf(stream,"%s %i %s",name[i],u,
+		sbm_value_label(sbm,sbm_value(sbm,u)));
+	for (r=0; r<k; r++) fprintf(stream," %.6f",q[k*u+r]);
+	fprintf(stream,"\n");
       }
+      fclose(stream);
+#pragma omp critical(output)
+      fwrite(buffer,1,size,stdout);
+      free(buffer);
     }
-  }
-
-  // Calculate the new values of the omega variables (after calculating
-  // the likelihood using the old omegas)
 
-  for (r=0; r<K; r++) {
-    for (s=0; s<K; s++) omega[r][s] = sum[r][s]/(d[r]*d[s]);
+    sbm_free(sbm);
   }
 
-  // Calculate the expected log-likelihood
-
-  // Internal energy first
-
-  L = 0.0;
-  for (r=0; r<K; r++) {
-    for (s=0; s<K; s++) L += 0.5*sum[r][s]*log(omega[r][s]);
-    for (i=0; i<nmlabels; i++) {
-      if (gmma[r][i]>0.0) L += nx[i]*gmma[r][i]*log(gmma[r][i]);
-    }
+  if (verbose) {
+    fprintf(stderr,"Fitted %i networks",ngraphs-nfailed);
+    if (nfailed>0) fprintf(stderr,", %i failed",nfailed);
+    fprintf(stderr,"\n");
   }
 
-  // Now the entropy
+  for (i=0; i<ngraphs; i++) free(name[i]);
+  free(name);
 
-  L -= 0.5*esum;
-  for (u=0; u<G.nvertices; u++) {
-    for (r=0; r<K; r++) {
-      if ((q[u][r]>0.0)&&(G.vertex[u].degree>0)) {
-	L += (G.vertex[u].degree-1)*q[u][r]*log(q[u][r]);
-      }
-    }
-  }
-
-  return L;
+  return nfailed;
 }
 
 
 void main(int argc, char *argv[])
 {
-  int u,v,i,r,s;
-  int step;
-  int bpsteps;
-  double norm,deltac,maxdelta;
-  double c[K][K];
-  double oldc[K][K];
-  double ru[K];
+  int u,r;
+  int k=2;               // Number of groups, by default 2
+  int kmax;              // Largest number of groups, when trying a range
+  int bestk;
+  int nruns=1;           // Number of runs from different starting points
+  int prune=0;           // Set to abandon runs that are clearly losing
+  int schedule=SBM_FLOOD;  // BP schedule
+  int opt;
+  int simd=VM_AUTO;      // Which vectorized log and exp to use
+  int checkmath=0;       // Set to test them against the C library and stop
+  int merge=0;           // Set to merge parallel edges
+  int verbose=1;         // Set to print progress reports to stderr
+  int resume=0;          // Set to carry on from the checkpoint
+  int precision=SBM_DOUBLE;  // Storage of the messages
+  int compare=0;         // Set to compare the result with double precision
+  int ordering=SBM_ORDER_NONE;  // Renumbering of the vertices
+  int nprocs=1;          // Number of processes for a single run
+  int status;
+  double maxdiff;
+  double interval=600.0; // Seconds between checkpoints
   double L;
-
-  // Initialize random number generator
-
-  rng = gsl_rng_alloc(gsl_rng_mt19937);
-  gsl_rng_set(rng,time(NULL));
-
-  // Read the network and the metadata from stdin
-
-#ifdef VERBOSE
-  fprintf(stderr,"Reading network...\n");
+  double bestscore=-HUGE_VAL;
+  double *bestq=NULL;    // Marginals for the best K
+  const double *q;
+  unsigned long seed;
+  char *savefile=NULL;   // Snapshot to write
+  char *loadfile=NULL;   // Snapshot to read instead of stdin
+  char *edgefile=NULL;   // Edge list and metadata to read instead of stdin
+  char *labelfile=NULL;
+  char *listfile=NULL;   // List of networks to fit one after another
+  char *statsfile=NULL;  // File for detailed statistics of the run
+  char *ckfile=NULL;     // File to save checkpoints in
+  char *scratch=NULL;    // Directory for out-of-core storage
+  char *deltafile=NULL;  // Changes to the network to fit after the first fit
+  char *modelfile=NULL;  // Model to score the network with instead of fitting
+  char *savemodel=NULL;  // File to save the fitted model in
+  SBM *sbm;
+  SBM_STATS stats;
+  static struct option options[] = {
+    { "groups", required_argument, NULL, 'k' },
+    { "threads", required_argument, NULL, 't' },
+    { "restarts", required_argument, NULL, 'n' },
+    { "seed", required_argument, NULL, 's' },
+    { "prune", no_argument, NULL, 'p' },
+    { "schedule", required_argument, NULL, 'b' },
+    { "simd", required_argument, NULL, 'm' },
+    { "check-math", no_argument, NULL, 'c' },
+    { "save-snapshot", required_argument, NULL, 'S' },
+    { "load-snapshot", required_argument, NULL, 'L' },
+    { "edges", required_argument, NULL, 'e' },
+    { "labels", required_argument, NULL, 'l' },
+    { "merge", no_argument, NULL, 'u' },
+    { "batch", required_argument, NULL, 'B' },
+    { "stats", required_argument, NULL, 'T' },
+    { "quiet", no_argument, NULL, 'q' },
+    { "checkpoint", required_argument, NULL, 'C' },
+    { "checkpoint-interval", required_argument, NULL, 'I' },
+    { "resume", no_argument, NULL, 'R' },
+    { "precision", required_argument, NULL, 'P' },
+    { "compare-double", no_argument, NULL, 'd' },
+    { "out-of-core", required_argument, NULL, 'O' },
+    { "reorder", required_argument, NULL, 'r' },
+    { "processes", required_argument, NULL, 'w' },
+    { "update", required_argument, NULL, 'D' },
+    { "score", required_argument, NULL, 'F' },
+    { "save-model", required_argument, NULL, 'W' },
+    { NULL, 0, NULL, 0 }
+  };
+
+  // Read the command line
+
+  seed = time(NULL);
+  kmax = k;
+  while ((opt=getopt_long(argc,argv,
+			  "k:t:n:s:pb:m:cS:L:e:l:uB:T:qC:I:RP:dO:r:w:D:F:W:",
+			  options,NULL))!=-1) {
+    switch (opt) {
+    case 'k':
+      k = kmax = atoi(optarg);
+      if (strchr(optarg,'-')!=NULL) kmax = atoi(strchr(optarg,'-')+1);
+      break;
+    case 't':
+#ifdef _OPENMP
+      if (atoi(optarg)>0) omp_set_num_threads(atoi(optarg));
 #endif
-  read_network(&G,stdin);
-  for (u=twom=0; u<G.nvertices; u++) twom += G.vertex[u].degree;
-  get_metadata();
-
-  // Make space for the marginals and initialize to random initial values
-
-  eta = malloc(G.nvertices*sizeof(double**));
-  q = malloc(G.nvertices*sizeof(double*));
-
-  for (u=0; u<G.nvertices; u++) {
-    q[u] = malloc(K*sizeof(double));
-    random_unity(K,q[u]);
+      break;
+    case 'n':
+      nruns = atoi(optarg);
+      break;
+    case 's':
+      seed = strtoul(optarg,NULL,10);
+      break;
+    case 'p':
+      prune = 1;
+      break;
+    case 'b':
+      if (strcmp(optarg,"flood")==0) schedule = SBM_FLOOD;
+      else if (strcmp(optarg,"residual")==0) schedule = SBM_RESIDUAL;
+      else k = 0;
+      break;
+    case 'm':
+      if (strcmp(optarg,"scalar")==0) simd = VM_SCALAR;
+      else if (strcmp(optarg,"avx2")==0) simd = VM_AVX2;
+      else if (strcmp(optarg,"avx512")==0) simd = VM_AVX512;
+      else k = 0;
+      break;
+    case 'c':
+      checkmath = 1;
+      break;
+    case 'S':
+      savefile = optarg;
+      break;
+    case 'L':
+      loadfile = optarg;
+      break;
+    case 'e':
+      edgefile = optarg;
+      break;
+    case 'l':
+      labelfile = optarg;
+      break;
+    case 'u':
+      merge = 1;
+      break;
+    case 'B':
+      listfile = optarg;
+      break;
+    case 'T':
+      statsfile = optarg;
+      break;
+    case 'q':
+      verbose = 0;
+      break;
+    case 'C':
+      ckfile = optarg;
+      break;
+    case 'I':
+      interval = atof(optarg);
+      break;
+    case 'R':
+      resume = 1;
+      break;
+    case 'P':
+      if (strcmp(optarg,"double")==0) precision = SBM_DOUBLE;
+      else if (strcmp(optarg,"float")==0) precision = SBM_FLOAT;
+      else if (strcmp(optarg,"bfloat16")==0) precision = SBM_BFLOAT16;
+      else k = 0;
+      break;
+    case 'd':
+      compare = 1;
+      break;
+    case 'O':
+      scratch = optarg;
+      break;
+    case 'w':
+      nprocs = atoi(optarg);
+      break;
+    case 'D':
+      deltafile = optarg;
+      break;
+    case 'F':
+      modelfile = optarg;
+      break;
+    case 'W':
+      savemodel = optarg;
+      break;
+    case 'r':
+      if (strcmp(optarg,"none")==0) ordering = SBM_ORDER_NONE;
+      else if (strcmp(optarg,"degree")==0) ordering = SBM_ORDER_DEGREE;
+      else if (strcmp(optarg,"bfs")==0) ordering = SBM_ORDER_BFS;
+      else if (strcmp(optarg,"rcm")==0) ordering = SBM_ORDER_RCM;
+      else k = 0;
+      break;
+    default:
+      k = 0;
+    }
+  }
+  if ((k<1)||(kmax<k)||(nruns<1)||(optind<argc)
+      ||((edgefile==NULL)!=(labelfile==NULL))
+      ||((edgefile!=NULL)&&(loadfile!=NULL))
+      ||((listfile!=NULL)&&((edgefile!=NULL)||(loadfile!=NULL)
+			    ||(savefile!=NULL)||(statsfile!=NULL)||(kmax>k)
+			    ||(scratch!=NULL)))
+      ||((ckfile!=NULL)&&((nruns>1)||(kmax>k)||(listfile!=NULL)))
+      ||(resume&&(ckfile==NULL))||(interval<0.0)
+      ||(compare&&((kmax>k)||(listfile!=NULL)||resume))
+      ||(nprocs<1)||((nprocs>1)&&((nruns>1)||(schedule!=SBM_FLOOD)
+				  ||(listfile!=NULL)))
+      ||((deltafile!=NULL)&&((kmax>k)||(listfile!=NULL)||compare))
+      ||((modelfile!=NULL)&&((kmax>k)||(listfile!=NULL)||resume))
+      ||((savemodel!=NULL)&&((kmax>k)||(listfile!=NULL)))) {
+    fprintf(stderr,"Usage: %s [-k groups|kmin-kmax] [-t threads] "
+	    "[-n restarts] [-s seed] [-p] [-b flood|residual] "
+	    "[-m scalar|avx2|avx512] [-P double|float|bfloat16] [-d] "
+	    "[-r none|degree|bfs|rcm] [-w processes] "
+	    "[-c] [-u] [-q] [-T statsfile] [-O scratch-dir] [-D changes] "
+	    "[-F model] [-W model] "
+	    "[-C checkpoint [-I seconds] [-R]] [-S snapshot] < network.gml\n"
+	    "   or: %s [options] -e edgelist -l metadata\n"
+	    "   or: %s [options] -L snapshot\n"
+	    "   or: %s [options] -B list-of-gml-files\n",
+	    argv[0],argv[0],argv[0],argv[0]);
+    exit(1);
   }
 
-  // Make space for the messages and initialize to the same values as the
-  // marginals
+  // Choose the log and exp functions, and check them if asked
 
-  for (u=0; u<G.nvertices; u++) {
-    eta[u] = malloc(G.vertex[u].degree*sizeof(double*));
-    for (i=0; i<G.vertex[u].degree; i++) {
-      eta[u][i] = malloc(K*sizeof(double));
-      v = G.vertex[u].edge[i].target;
-      for (r=0; r<K; r++) eta[u][i][r] = q[v][r];
-    }
+  simd = vecmath_init(simd);
+  if (checkmath) {
+    maxdiff = vecmath_check();
+    printf("%s: largest relative difference from C library = %g "
+	   "(tolerance %g)\n",vecmath_name(simd),maxdiff,VM_TOLERANCE);
+    exit(maxdiff>VM_TOLERANCE);
   }
+  if (verbose) fprintf(stderr,"Using %s log and exp\n",vecmath_name(simd));
 
-  nrx = malloc(K*sizeof(double*));
-  for (r=0; r<K; r++) nrx[r] = malloc(nmlabels*sizeof(double));
+  // In batch mode, fit all the networks in the list and stop
 
-  // Malloc space for parameters gmma and choose random initial values
-
-  gmma = malloc(K*sizeof(double*));
-  for (r=0; r<K; r++) gmma[r] = malloc(nmlabels*sizeof(double));
-  for (i=0; i<nmlabels; i++) {
-    random_unity(K,ru);
-    for (r=0; r<K; r++) gmma[r][i] = ru[r];
+  if (listfile!=NULL) {
+    status = batch(listfile,k,schedule,nruns,seed,prune,merge,precision,
+		   ordering,verbose);
+    exit(status!=0 ? 2 : 0);
   }
 
-  // Choose random values for the omegas, but with a bias toward
-  // assortative choices (change if necessary for other networks)
-
-  for (r=0; r<K; r++) {
-    for (s=0; s<K; s++) {
-      if (r==s) c[r][s] = 1 + gsl_rng_uniform(rng);
-      else if (r<s) c[r][s] = gsl_rng_uniform(rng);
-      else c[r][s] = c[s][r];
-      omega[r][s] = c[r][s]/twom;
+  sbm = sbm_new();
+  sbm_set_groups(sbm,k);
+  sbm_set_schedule(sbm,schedule);
+  sbm_set_restarts(sbm,nruns);
+  sbm_set_seed(sbm,seed);
+  sbm_set_prune(sbm,prune);
+  sbm_set_verbose(sbm,verbose);
+  sbm_set_precision(sbm,precision);
+  if (ckfile!=NULL) sbm_set_checkpoint(sbm,ckfile,interval);
+  if (scratch!=NULL) sbm_set_scratch(sbm,scratch);
+  sbm_set_order(sbm,ordering);
+  sbm_set_processes(sbm,nprocs);
+  if (modelfile!=NULL) {
+    if (sbm_read_model(sbm,modelfile)!=0) exit(2);
+    k = kmax = sbm_groups(sbm);
+    if (verbose) {
+      fprintf(stderr,"Scoring with model %s, %i groups\n",modelfile,k);
     }
   }
 
-  // EM loop
-
-#ifdef VERBOSE
-  fprintf(stderr,"Starting EM algorithm...\n");
-#endif
-  step = 0;
-  do {
-
-    // Run BP to calculate the messages and one-vertex marginals
-
-    bpsteps = bp();
-
-    // Calculate the new values of the parameters
-
-    L = params();
-
-    // Calculate the new values of the c variables
-
-    for (r=0; r<K; r++) {
-      for (s=0; s<K; s++) {
-	oldc[r][s] = c[r][s];
-	c[r][s] = omega[r][s]*twom;
-      }
+  // Read the network and the metadata, from a snapshot, an edge list, or
+  // stdin.  If we're asked to save a snapshot we do that and stop.
+
+  if (loadfile!=NULL) {
+    if (verbose) fprintf(stderr,"Loading snapshot %s...\n",loadfile);
+    status = sbm_read_snapshot(sbm,loadfile);
+  } else if (edgefile!=NULL) {
+    if (verbose) fprintf(stderr,"Reading network...\n");
+    status = sbm_read_edgelist(sbm,edgefile,labelfile);
+  } else {
+    if (verbose) fprintf(stderr,"Reading network...\n");
+    status = sbm_read_gml(sbm,stdin);
+  }
+  if (status!=0) exit(2);
+  if (merge) {
+    sbm_merge(sbm);
+    if (verbose) {
+      fprintf(stderr,"Merged parallel edges, leaving %li\n",
+	      sbm_network(sbm)->nedges);
     }
+  }
+  if (savefile!=NULL) {
+    if (sbm_write_snapshot(sbm,savefile)!=0) exit(2);
+    if (verbose) fprintf(stderr,"Saved snapshot %s\n",savefile);
+    exit(0);
+  }
 
-    // Find the largest change in any of the c's
-
-    maxdelta = 0.0;
-    for (r=0; r<K; r++) {
-      for (s=0; s<K; s++) {
-	deltac = fabs(c[r][s]-oldc[r][s]);
-        if (deltac>maxdelta) maxdelta = deltac;
+  // Do the runs.  Given a range of K, we do each K in turn, each after the
+  // first starting from the best solution for the one before, and keep the
+  // K with the best score.  When resuming, the number of groups comes from
+  // the checkpoint, and if there isn't one yet we start from scratch.
+
+  if (resume&&(access(ckfile,F_OK)==0)) {
+    if (verbose) fprintf(stderr,"Resuming from checkpoint %s\n",ckfile);
+    status = sbm_resume(sbm,ckfile);
+    k = kmax = sbm_groups(sbm);
+  } else status = sbm_run(sbm);
+  if (status!=0) exit(2);
+  if (kmax>k) {
+    bestq = malloc(sbm_nvertices(sbm)*kmax*sizeof(double));
+    for (bestk=k; ; ) {
+      sbm_stats(sbm,&stats);
+      fprintf(stderr,"K = %i: log-likelihood = %g, score = %g, "
+	      "%li EM steps\n",sbm_groups(sbm),stats.L,stats.score,
+	      stats.totalemsteps);
+      if (stats.score>bestscore) {
+	bestk = sbm_groups(sbm);
+	bestscore = stats.score;
+	memcpy(bestq,sbm_marginals(sbm),
+	       sbm_nvertices(sbm)*bestk*sizeof(double));
       }
+      if (sbm_groups(sbm)==kmax) break;
+      if (sbm_run_split(sbm)!=0) exit(2);
     }
-
-    // Print out new values of the parameters
-
-#ifdef VERBOSE
-    fprintf(stderr,"EM step %i, max change = %g\n",step,maxdelta);
-    fprintf(stderr,"gamma =\n");
-    for (r=0; r<K; r++) {
-      for (i=0; i<nmlabels; i++) fprintf(stderr," %.6f",gmma[r][i]);
-      fprintf(stderr,"\n");
+    fprintf(stderr,"Best score = %g for K = %i\n",bestscore,bestk);
+    q = bestq;
+    k = bestk;
+  } else {
+    sbm_stats(sbm,&stats);
+    if (nruns>1) {
+      fprintf(stderr,"Best log-likelihood = %g from run %i (seed %lu)\n",
+	      stats.L,stats.run,stats.seed);
     }
-
-    fprintf(stderr,"c =\n");
-    for (r=0; r<K; r++) {
-      for (s=0; s<K; s++) fprintf(stderr," %.6f",c[r][s]);
+    else if (verbose) fprintf(stderr,"Log-likelihood = %g\n\n",stats.L);
+    if (verbose) {
+      fprintf(stderr,"Message updates = %li",stats.updates);
+      if (schedule==SBM_RESIDUAL) {
+	fprintf(stderr,", %li fewer than flooding for the same number of "
+		"sweeps",stats.sweeps*sbm_network(sbm)->nedges-stats.updates);
+      }
       fprintf(stderr,"\n");
     }
-    fprintf(stderr,"\n");
-#endif
-
-    if (++step>EM_MAXSTEP) {
-#ifdef NOCONVERGE
-      fprintf(stderr,"Solution failed to converge in %i EM steps\n",
-	      EM_MAXSTEP);
-      break;
-#endif
-    }
-
-  } while (maxdelta>EM_ACC);
+    q = sbm_marginals(sbm);
+  }
 
-#ifdef NOCONVERGE
-  if (bpsteps>BP_MAXSTEP) {
-    fprintf(stderr,"BP failed converge on final EM step\n");
+  // If asked, change the network and fit it again, starting from the fit
+  // we already have
+
+  if (deltafile!=NULL) {
+    if (read_changes(sbm,deltafile)<0) exit(2);
+    if (verbose) fprintf(stderr,"Updating from %s...\n",deltafile);
+    if (sbm_update(sbm)!=0) exit(2);
+    sbm_stats(sbm,&stats);
+    fprintf(stderr,"Log-likelihood after changes = %g, %li message updates, "
+	    "%i EM steps\n",stats.L,stats.updates,stats.emsteps);
+    q = sbm_marginals(sbm);
   }
-#endif
 
-#ifdef VERBOSE
-  fprintf(stderr,"Log-likelihood = %g\n\n",L);
-#endif
+  // Save the model if asked
+
+  if ((savemodel!=NULL)&&(sbm_write_model(sbm,savemodel)!=0)) exit(2);
+
+  // Write the detailed statistics if asked.  For a range of K they are
+  // for the last K.
+
+  if ((statsfile!=NULL)&&(sbm_write_stats(sbm,statsfile)!=0)) exit(2);
+
+  // If asked, do the same calculation again with the messages stored as
+  // doubles and report the difference in the log-likelihood, keeping the
+  // results of the first calculation for the output
+
+  if (compare&&(precision!=SBM_DOUBLE)) {
+    bestq = malloc(sbm_nvertices(sbm)*k*sizeof(double));
+    memcpy(bestq,q,sbm_nvertices(sbm)*k*sizeof(double));
+    q = bestq;
+    L = stats.L;
+    if (verbose) fprintf(stderr,"Repeating with double precision...\n");
+    sbm_set_verbose(sbm,0);
+    sbm_set_checkpoint(sbm,NULL,0.0);
+    sbm_set_precision(sbm,SBM_DOUBLE);
+    if (sbm_run(sbm)!=0) exit(2);
+    sbm_stats(sbm,&stats);
+    fprintf(stderr,"Log-likelihood = %.10g with %s messages, %.10g with "
+	    "double, difference = %g (relative %g)\n",L,
+	    precision==SBM_FLOAT ? "float" : "bfloat16",stats.L,L-stats.L,
+	    fabs((L-stats.L)/stats.L));
+  }
 
   // Output the results
 
-  for (u=0; u<G.nvertices; u++) {
-    printf("%i %s",u,mlabel[x[u]]);
-    for (r=0; r<K; r++) printf(" %.6f",q[u][r]);
+  for (u=0; u<sbm_nvertices(sbm); u++) {
+    printf("%i %s",u,sbm_value_label(sbm,sbm_value(sbm,u)));
+    for (r=0; r<k; r++) printf(" %.6f",q[k*u+r]);
     printf("\n");
   }
+
+  free(bestq);
+  sbm_free(sbm);
 }
@@ -10,20 +10,41 @@ typedef struct {
                      // (Note that this is not necessarily equal to the GML
                      // ID of the neighbor if IDs are nonconsecutive or do
                      // not start at zero.)
+  int twin;          // Index in the neighbor's edge[] array of the edge
+                     // leading back to this vertex.  -1 if there is none.
+  int parallel;      // Number of edges joining the same two vertices.  (A
+                     // self-edge appears twice in its vertex's list and so
+                     // counts two.)
+  int multiplicity;  // Number of edges this one stands for: 1, unless
+                     // parallel edges have been merged
   double weight;     // Weight of edge.  1 if no weight is specified.
 } EDGE;
 
 typedef struct {
   int id;            // GML ID number of vertex
-  int degree;        // Degree of vertex (out-degree for directed nets)
-  char *label;       // GML label of vertex.  NULL if no label specified
-  EDGE *edge;        // Array of EDGE structs, one for each neighbor
+  int degree;        // Degree of vertex (out-degree for directed nets),
+                     // which is the number of EDGE structs
+  int multidegree;   // Degree counting each edge with its multiplicity
+  int label;         // Label of vertex, as an index into network->label[]
+  long offset;       // Index in network->edge[] of the vertex's first edge
+  EDGE *edge;        // Array of EDGE structs, one for each neighbor.  Points
+                     // into network->edge[]
 } VERTEX;
 
 typedef struct {
   int nvertices;     // Number of vertices in network
   int directed;      // 1 = directed network, 0 = undirected
+  long nedges;       // Total number of EDGE structs (twice the number of
+                     // edges for undirected networks)
   VERTEX *vertex;    // Array of VERTEX structs, one for each vertex
+  EDGE *edge;        // All the EDGE structs in one block, in vertex order
+  char *map;         // Snapshot file the edges and labels are mapped from,
+                     // or NULL if they were read from a GML file
+  long maplength;    // Length of the mapped file
+  int nlabels;       // Number of distinct vertex labels
+  char **label;      // The distinct labels, in the order first seen
+  int *labelhash;    // Hash table of labels, used while reading
+  int hashsize;      // Size of the hash table (a power of two)
 } NETWORK;
 
 #endif
@@ -0,0 +1,579 @@
+// Functions to read a network stored as a plain edge list, with the
+// metadata in a separate file, into a NETWORK struct
+//
+// The edge list has one edge per line, given by the IDs of the two
+// vertices it joins, optionally followed by a weight, separated by spaces
+// or tabs:
+//
+//   0 1
+//   0 2 1.5
+//
+// The metadata file has one vertex per line, its ID followed by its label,
+// which is the rest of the line after the spaces or tabs that follow the
+// ID.  The vertices of the network are the ones listed in the metadata
+// file.  In both files blank lines and lines starting with "#" or "%" are
+// ignored.  Networks read this way are undirected, and either file can be
+// compressed with gzip.
+//
+// The text is divided into pieces at line boundaries and the pieces are
+// parsed in parallel, first to count the lines and then, once it is known
+// where each piece's results go, to read them.  Compressed files are
+// decompressed a block at a time and each block is parsed the same way.
+// The edges end up in the same order they would if the network had been
+// read from the equivalent GML file.
+//
+// To use this package, #include "readedges.h" at the head of your program
+// and then call the following:
+//
+// Function calls:
+//   int read_edgelist(NETWORK *network, char *edgefile, char *labelfile)
+//     -- Reads a network from the two named files into the structure
+//        "network".  Returns 0 if read was successful.  The network is
+//        freed again with free_network() from readgml.c.
+
+
+// Inclusions
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "network.h"
+#include "readgml.h"
+
+// Constants
+
+#define READSIZE 67108864      // Bytes of compressed text parsed at a time
+#define MINPIECE 65536         // Smallest piece of text given to a thread
+#define NSCAN 64               // Pieces in a parallel prefix sum
+
+enum { EDGES, LABELS };        // Which kind of file we are reading
+
+// Types
+
+typedef struct {
+  int source,target;           // IDs, and later indices, of the two ends
+  double weight;
+} LISTEDGE;
+
+typedef struct {
+  int kind;                    // EDGES or LABELS
+  long n;                      // Number of lines read so far
+  long size;                   // Space available
+  LISTEDGE *edge;              // The edges, or...
+  VERTEX *vertex;              // ...the vertices
+  char **text;                 // Text of each vertex's label until it's
+  long *length;                // been looked up in the table of labels
+  NETWORK *network;            // Network holding the table of labels
+} RESULT;
+
+typedef struct {
+  char *map;                   // File contents if mapped, or NULL
+  size_t maplength;
+  gzFile gz;                   // Otherwise the file, through zlib
+  char *buffer;                // Text read from gz
+  size_t size;                 // Size of buffer
+  size_t length;               // Amount of text in buffer
+  size_t used;                 // Amount handed out by next_block()
+  int done;                    // Set when gz is exhausted
+} SOURCE;
+
+
+// Function to open a file for reading.  Uncompressed regular files are
+// mapped into memory; anything else is read through zlib, which also
+// handles uncompressed pipes.  Returns 0 if successful.
+
+int open_source(SOURCE *src, char *filename)
+{
+  int fd;
+  unsigned char magic[2];
+  struct stat status;
+
+  memset(src,0,sizeof(SOURCE));
+  fd = open(filename,O_RDONLY);
+  if (fd<0) {
+    fprintf(stderr,"Unable to open file %s\n",filename);
+    return 1;
+  }
+
+  if ((fstat(fd,&status)==0)&&S_ISREG(status.st_mode)&&(status.st_size>2)
+      &&(pread(fd,magic,2,0)==2)&&!((magic[0]==0x1f)&&(magic[1]==0x8b))) {
+    src->map = mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if (src->map!=MAP_FAILED) {
+      madvise(src->map,status.st_size,MADV_SEQUENTIAL);
+      src->maplength = status.st_size;
+      close(fd);
+      return 0;
+    }
+    src->map = NULL;
+  }
+
+  src->gz = gzdopen(fd,"r");
+  if (src->gz==NULL) {
+    fprintf(stderr,"Unable to read file %s\n",filename);
+    close(fd);
+    return 1;
+  }
+  gzbuffer(src->gz,1<<20);
+  src->size = READSIZE;
+  src->buffer = malloc(src->size);
+
+  return 0;
+}
+
+
+// Function to get the next block of whole lines from a file.  Returns 0 if
+// there was one, 1 at the end of the file, or -1 on a read error.
+
+int next_block(SOURCE *src, char **text, size_t *length)
+{
+  int n;
+  char *end;
+
+  // A mapped file is all one block
+
+  if (src->map!=NULL) {
+    if (src->used==src->maplength) return 1;
+    *text = src->map;
+    *length = src->used = src->maplength;
+    return 0;
+  }
+
+  // Otherwise move any partial line left over from last time to the start
+  // of the buffer and fill up the rest.  If one line fills the whole
+  // buffer, make the buffer bigger.
+
+  memmove(src->buffer,src->buffer+src->used,src->length-src->used);
+  src->length -= src->used;
+  src->used = 0;
+  for (;;) {
+    while (!src->done&&(src->length<src->size)) {
+      n = src->size - src->length;
+      if (n>(1<<30)) n = 1<<30;
+      n = gzread(src->gz,src->buffer+src->length,n);
+      if (n<0) return -1;
+      if (n==0) src->done = 1;
+      src->length += n;
+    }
+    if (src->done) {
+      if (src->length==0) return 1;
+      *text = src->buffer;
+      *length = src->used = src->length;
+      return 0;
+    }
+    for (end=src->buffer+src->length; end>src->buffer; end--) {
+      if (end[-1]=='\n') break;
+    }
+    if (end>src->buffer) break;
+    src->size *= 2;
+    src->buffer = realloc(src->buffer,src->size);
+  }
+
+  *text = src->buffer;
+  *length = src->used = end - src->buffer;
+  return 0;
+}
+
+
+// Function to close a file again
+
+void close_source(SOURCE *src)
+{
+  if (src->map!=NULL) munmap(src->map,src->maplength);
+  else gzclose(src->gz);
+  free(src->buffer);
+}
+
+
+// Function to read an integer from the text, advancing *p past it.
+// Returns 0 if successful.
+
+int read_id(char **p, char *end, int *id)
+{
+  int negative=0;
+  long value=0;
+  char *q=*p;
+
+  if ((q<end)&&(*q=='-')) {
+    negative = 1;
+    q++;
+  }
+  if ((q==end)||(*q<'0')||(*q>'9')) return 1;
+  for (; (q<end)&&(*q>='0')&&(*q<='9'); q++) {
+    value = 10*value + (*q-'0');
+    if (value>2147483648L) return 1;
+  }
+  if (negative) value = -value;
+  if (value>2147483647L) return 1;
+  *id = value;
+  *p = q;
+  return 0;
+}
+
+
+// Function to parse one line, starting at p and ending before end (which
+// is the newline or the end of the text).  If r is not NULL the result is
+// stored in r->edge[i] or r->vertex[i].  Returns 1 if the line held an
+// edge or vertex, 0 if it was blank or a comment, and -1 if it couldn't be
+// read.
+
+int parse_line(char *p, char *end, RESULT *r, long i)
+{
+  int s,t;
+  char *q;
+  double w=1.0;
+
+  while ((p<end)&&((*p==' ')||(*p=='\t'))) p++;
+  while ((end>p)&&((end[-1]=='\r')||(end[-1]==' ')||(end[-1]=='\t'))) end--;
+  if ((p==end)||(*p=='#')||(*p=='%')) return 0;
+
+  if (read_id(&p,end,&s)) return -1;
+  if ((p<end)&&(*p!=' ')&&(*p!='\t')) return -1;
+  while ((p<end)&&((*p==' ')||(*p=='\t'))) p++;
+
+  // A vertex and its label
+
+  if ((r!=NULL)&&(r->kind==LABELS)) {
+    r->vertex[i].id = s;
+    r->vertex[i].degree = 0;
+    r->text[i] = p;
+    r->length[i] = end - p;
+    return 1;
+  }
+  if (r==NULL) return 1;
+
+  // An edge
+
+  if (read_id(&p,end,&t)) return -1;
+  while ((p<end)&&((*p==' ')||(*p=='\t'))) p++;
+  if (p<end) {
+    for (q=p; (q<end)&&(*q!=' ')&&(*q!='\t'); q++);
+    if (read_number(p,q-p,&w)) return -1;
+  }
+  r->edge[i].source = s;
+  r->edge[i].target = t;
+  r->edge[i].weight = w;
+  return 1;
+}
+
+
+// Function to parse a block of whole lines in parallel and add the results
+// to the end of those in r.  Returns 0 if successful.
+
+int parse_block(char *text, size_t length, RESULT *r)
+{
+  int i,npieces;
+  long j;
+  int error=0;
+  long *count;
+  char **start;
+
+  // Divide the text into pieces that start at the beginnings of lines
+
+#ifdef _OPENMP
+  npieces = 4*omp_get_max_threads();
+#else
+  npieces = 1;
+#endif
+  if (npieces>length/MINPIECE) npieces = length/MINPIECE;
+  if (npieces<1) npieces = 1;
+  start = malloc((npieces+1)*sizeof(char*));
+  count = malloc((npieces+1)*sizeof(long));
+  start[0] = text;
+  start[npieces] = text + length;
+  for (i=1; i<npieces; i++) {
+    start[i] = memchr(text+length/npieces*i,'\n',
+		      text+length-(text+length/npieces*i));
+    start[i] = start[i]==NULL ? text+length : start[i]+1;
+    if (start[i]<start[i-1]) start[i] = start[i-1];
+  }
+
+  // Count the lines in each piece
+
+#pragma omp parallel for schedule(dynamic)
+  for (i=0; i<npieces; i++) {
+    char *p,*eol;
+    count[i] = 0;
+    for (p=start[i]; p<start[i+1]; p=eol+1) {
+      eol = memchr(p,'\n',start[i+1]-p);
+      if (eol==NULL) eol = start[i+1];
+      if (parse_line(p,eol,NULL,0)>0) count[i]++;
+    }
+  }
+
+  // Work out where each piece's lines go and make space for them
+
+  for (i=0; i<npieces; i++) count[i+1] += count[i];
+  for (i=npieces; i>0; i--) count[i] = count[i-1] + r->n;
+  count[0] = r->n;
+  if (count[npieces]>r->size) {
+    r->size = count[npieces] + count[npieces]/2;
+    if (r->kind==EDGES) r->edge = realloc(r->edge,r->size*sizeof(LISTEDGE));
+    else {
+      r->vertex = realloc(r->vertex,r->size*sizeof(VERTEX));
+      r->text = realloc(r->text,r->size*sizeof(char*));
+      r->length = realloc(r->length,r->size*sizeof(long));
+    }
+  }
+
+  // Read the lines
+
+#pragma omp parallel for schedule(dynamic)
+  for (i=0; i<npieces; i++) {
+    long j=count[i];
+    char *p,*eol;
+    for (p=start[i]; p<start[i+1]; p=eol+1) {
+      eol = memchr(p,'\n',start[i+1]-p);
+      if (eol==NULL) eol = start[i+1];
+      switch (parse_line(p,eol,r,j)) {
+      case 1:
+	j++;
+	break;
+      case -1:
+#pragma omp critical(report)
+	{
+	  if (!error) fprintf(stderr,"Unable to read line \"%.*s\"\n",
+			      (int)(eol-p),p);
+	  error = 1;
+	}
+      }
+    }
+  }
+  r->n = count[npieces];
+
+  // Look up the labels while we still have their text.  This is done in
+  // order, so that the labels are numbered in the order they're first seen.
+
+  if ((r->kind==LABELS)&&!error) {
+    for (j=count[0]; j<r->n; j++) {
+      r->vertex[j].label = intern_label(r->network,r->text[j],r->length[j]);
+    }
+  }
+
+  free(start);
+  free(count);
+  return error;
+}
+
+
+// Function to read a whole file.  Returns 0 if successful.
+
+int read_file(char *filename, RESULT *r)
+{
+  int status;
+  size_t length;
+  char *text;
+  SOURCE src;
+
+  if (open_source(&src,filename)) return 1;
+  while ((status=next_block(&src,&text,&length))==0) {
+    if (parse_block(text,length,r)) break;
+  }
+  close_source(&src);
+  if (status<0) fprintf(stderr,"Error reading file %s\n",filename);
+
+  return status<=0;
+}
+
+
+// Function to calculate the cumulative sums of a[0]...a[n-1] in place,
+// putting the total in a[n], so that a[i] becomes the sum of the elements
+// before i.  The array is divided into NSCAN pieces whose totals are
+// calculated in parallel.
+
+void prefix_sum(long *a, int n)
+{
+  int i;
+  long total[NSCAN+1];
+
+#pragma omp parallel for
+  for (i=0; i<NSCAN; i++) {
+    int j;
+    total[i+1] = 0;
+    for (j=(long)n*i/NSCAN; j<(long)n*(i+1)/NSCAN; j++) total[i+1] += a[j];
+  }
+  for (i=total[0]=0; i<NSCAN; i++) total[i+1] += total[i];
+
+#pragma omp parallel for
+  for (i=0; i<NSCAN; i++) {
+    int j;
+    long sum=total[i],value;
+    for (j=(long)n*i/NSCAN; j<(long)n*(i+1)/NSCAN; j++) {
+      value = a[j];
+      a[j] = sum;
+      sum += value;
+    }
+  }
+  a[n] = total[NSCAN];
+}
+
+
+// Function to compare two vertex IDs, or two longs
+
+int cmpvertex(const void *v1, const void *v2)
+{
+  const VERTEX *v1p=v1,*v2p=v2;
+
+  if (v1p->id>v2p->id) return 1;
+  if (v1p->id<v2p->id) return -1;
+  return 0;
+}
+
+int cmplong(const void *a, const void *b)
+{
+  long la=*(const long*)a,lb=*(const long*)b;
+
+  if (la>lb) return 1;
+  if (la<lb) return -1;
+  return 0;
+}
+
+
+// Function to read a network and its metadata
+
+int read_edgelist(NETWORK *network, char *edgefile, char *labelfile)
+{
+  int u;
+  int error=0;
+  long j,nentries;
+  long *offset;          // Start of each vertex's edges
+  long *fill;            // Next free slot for each vertex's edges
+  long *entry;           // Edge list entry for each EDGE struct
+  RESULT vertices,edges;
+
+  memset(network,0,sizeof(NETWORK));
+  memset(&vertices,0,sizeof(RESULT));
+  memset(&edges,0,sizeof(RESULT));
+  vertices.kind = LABELS;
+  vertices.network = network;
+  edges.kind = EDGES;
+
+  // Read the vertices and sort them by ID
+
+  error = read_file(labelfile,&vertices);
+  finish_labels(network);
+  free(vertices.text);
+  free(vertices.length);
+  network->nvertices = vertices.n;
+  network->vertex = vertices.vertex;
+  if (error) {
+    free_network(network);
+    return 1;
+  }
+  qsort(vertices.vertex,vertices.n,sizeof(VERTEX),cmpvertex);
+  for (j=1; j<vertices.n; j++) {
+    if (vertices.vertex[j].id==vertices.vertex[j-1].id) {
+      fprintf(stderr,"Vertex %i appears twice in %s\n",
+	      vertices.vertex[j].id,labelfile);
+      error = 1;
+      break;
+    }
+  }
+  if (error) {
+    free_network(network);
+    return 1;
+  }
+
+  // Read the edges and find their ends.  Each edge appears in two lists,
+  // and its appearances are numbered 2j (in the list of the source) and
+  // 2j+1 (in the list of the target).  The degrees are counted in fill[].
+
+  if (read_file(edgefile,&edges)) {
+    free(edges.edge);
+    free_network(network);
+    return 1;
+  }
+  nentries = 2*edges.n;
+  offset = malloc((network->nvertices+1)*sizeof(long));
+  fill = calloc(network->nvertices+1,sizeof(long));
+
+#pragma omp parallel for schedule(static)
+  for (j=0; j<edges.n; j++) {
+    int vs,vt;
+    vs = find_vertex(edges.edge[j].source,network);
+    vt = find_vertex(edges.edge[j].target,network);
+    if ((vs<0)||(vt<0)) {
+#pragma omp critical(report)
+      {
+	if (!error) fprintf(stderr,"Edge %i -- %i refers to a vertex that "
+			    "isn't in %s\n",edges.edge[j].source,
+			    edges.edge[j].target,labelfile);
+	error = 1;
+      }
+      continue;
+    }
+    edges.edge[j].source = vs;
+    edges.edge[j].target = vt;
+#pragma omp atomic
+    fill[vs]++;
+#pragma omp atomic
+    fill[vt]++;
+  }
+  if (error) {
+    free(offset);
+    free(fill);
+    free(edges.edge);
+    free_network(network);
+    return 1;
+  }
+
+  // Work out where each vertex's edges go
+
+  prefix_sum(fill,network->nvertices);
+  memcpy(offset,fill,(network->nvertices+1)*sizeof(long));
+
+  // Put the entries in their vertices' lists.  Threads may fill each list
+  // in any order, so the lists are sorted afterwards to put the edges in
+  // the order they appeared in the file.
+
+  entry = malloc(nentries*sizeof(long));
+
+#pragma omp parallel for schedule(static)
+  for (j=0; j<edges.n; j++) {
+    long pos;
+#pragma omp atomic capture
+    pos = fill[edges.edge[j].source]++;
+    entry[pos] = 2*j;
+#pragma omp atomic capture
+    pos = fill[edges.edge[j].target]++;
+    entry[pos] = 2*j + 1;
+  }
+
+  network->nedges = nentries;
+  network->edge = malloc(nentries*sizeof(EDGE));
+
+#pragma omp parallel for schedule(dynamic,1024)
+  for (u=0; u<network->nvertices; u++) {
+    long i,k;
+    LISTEDGE *le;
+    VERTEX *v=network->vertex+u;
+    v->offset = offset[u];
+    v->degree = offset[u+1] - offset[u];
+    v->edge = network->edge + offset[u];
+    qsort(entry+offset[u],v->degree,sizeof(long),cmplong);
+    for (i=0; i<v->degree; i++) {
+      k = entry[offset[u]+i];
+      le = edges.edge + k/2;
+      v->edge[i].target = k%2 ? le->source : le->target;
+      v->edge[i].weight = le->weight;
+      v->edge[i].multiplicity = 1;
+    }
+  }
+
+  free(entry);
+  free(offset);
+  free(fill);
+  free(edges.edge);
+  find_twins(network);
+
+  return 0;
+}
@@ -0,0 +1,10 @@
+// Header file for the edge list reader
+
+#ifndef _READEDGES_H
+#define _READEDGES_H
+
+#include "network.h"
+
+int read_edgelist(NETWORK *network, char *edgefile, char *labelfile);
+
+#endif
@@ -3,6 +3,20 @@
 // Written by Mark Newman  11 AUG 06
 // Changed to allow node labels containing the word "node", which previously
 //   confused the (rather simple) code for counting network nodes  3 DEC 14
+// Changed to record the reverse of each edge, so that the edge from v back
+//   to u can be found without searching v's list of edges  17 OCT 26
+// Changed to store all the edges in a single block, in vertex order, so
+//   that per-edge data can be kept in flat arrays indexed by offset
+//   17 OCT 26
+// Rewritten to map the file into memory and read it with a tokenizer in
+//   two passes over the text, rather than copying it into a list of lines
+//   and scanning that five times.  There is no longer any limit on the
+//   length of a line  17 OCT 26
+// Changed to store each distinct label once, in a table that is looked up
+//   through a hash table as the file is read, with each vertex holding the
+//   index of its label in the table  17 OCT 26
+// Added merging of parallel edges into single edges with multiplicities
+//   17 OCT 26
 //
 // To use this package, #include "readgml.h" at the head of your program
 // and then call the following:
@@ -11,9 +25,31 @@
 //   int read_network(NETWORK *network, FILE *stream)
 //     -- Reads a network from the FILE pointed to by "stream" into the
 //        structure "network".  For the format of NETWORK structs see file
-//        "network.h".  Returns 0 if read was successful.
+//        "network.h".  Returns 0 if read was successful, or 1 if an edge
+//        refers to a vertex ID that doesn't exist.
+//   void merge_edges(NETWORK *network)
+//     -- Merges all the edges joining the same two vertices into a single
+//        edge, whose multiplicity is the number of edges merged and whose
+//        weight is the sum of their weights
 //   void free_network(NETWORK *network)
-//     -- Destroys a NETWORK struct again, freeing up the memory
+//     -- Destroys a NETWORK struct again, freeing up the memory (or, for a
+//        network loaded from a snapshot, unmapping the file)
+//
+// The following are also used by the other network readers:
+//   int read_number(char *start, size_t length, double *value)
+//     -- Converts the text of given length to a number.  Returns 0 if it
+//        was a number.
+//   int find_vertex(int id, NETWORK *network)
+//     -- Returns the position in network->vertex[] of the vertex with the
+//        given ID, or -1, once the vertices have been sorted by ID
+//   void find_twins(NETWORK *network)
+//     -- Sets the twin and parallel fields of all the edges and the
+//        multidegrees of the vertices
+//   int intern_label(NETWORK *network, char *text, size_t length)
+//     -- Returns the index in network->label[] of the label with the given
+//        text, adding it if it's new
+//   void finish_labels(NETWORK *network)
+//     -- Frees the hash table of labels once reading is done
 
 
 // Inclusions
@@ -21,256 +57,369 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "network.h"
+#include "readgml.h"
 
 // Constants
 
-#define LINELENGTH 1000
+#define READSIZE 1048576       // Bytes to read at a time from a pipe
+#define MAXNUMBER 64           // Size of buffer for numbers given to strtod()
+#define HASHSIZE 1024          // Initial size of the hash table of labels
 
-// Types
+enum { TOKEN_END, TOKEN_OPEN, TOKEN_CLOSE, TOKEN_STRING, TOKEN_WORD };
 
-typedef struct line {
-  char *str;
-  struct line *ptr;
-} LINE;
+enum { IN_NONE, IN_NODE, IN_EDGE };    // What we are inside of
 
-// Globals
+// Types
 
-LINE *first;
-LINE *current;
+typedef struct {
+  char *ptr;             // Next character to be read
+  char *end;             // One past the last character
+} TEXT;
 
+typedef struct {
+  int source,target;     // IDs, and later indices, of the ends of an edge
+  double weight;
+} GMLEDGE;
 
-// Function to read one line from a specified stream.  Return value is
-// 1 if an EOF was encountered.  Otherwise 0.
 
-int read_line(FILE *stream, char line[LINELENGTH])
-{
-  if (fgets(line,LINELENGTH,stream)==NULL) return 1;
-  line[strlen(line)-1] = '\0';   // Erase the terminating NEWLINE
-  return 0;
-}
+// Function to get the text of a stream into memory.  If the stream is a
+// regular file it is mapped directly; otherwise (a pipe, say) it is read
+// into a single malloc'd block.  Sets *mapped to 1 if the text was mapped
+// and must be unmapped with munmap() rather than freed.  Returns NULL if
+// the stream is empty.
 
-
-// Function to read in the whole file into a linked-list buffer, so that we
-// can do several passes on it, as required to read the GML format
-// efficiently
-
-int fill_buffer(FILE *stream)
+char *load_text(FILE *stream, size_t *length, int *mapped)
 {
-  int length;
-  char line[LINELENGTH];
-  LINE *previous;
-
-  if (read_line(stream,line)!=0) {
-    first = NULL;                // Indicates empty buffer
-    return 1;
+  int fd;
+  size_t size,n;
+  off_t position;
+  char *text;
+  struct stat status;
+
+  fd = fileno(stream);
+  position = ftello(stream);
+
+  // Map the file if we can.  (If some of it has already been read we read
+  // the rest in the usual way instead.)
+
+  if ((position==0)&&(fstat(fd,&status)==0)&&S_ISREG(status.st_mode)
+      &&(status.st_size>0)) {
+    text = mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+    if (text!=MAP_FAILED) {
+      madvise(text,status.st_size,MADV_SEQUENTIAL);
+      *mapped = 1;
+      *length = status.st_size;
+      return text;
+    }
   }
-  length = strlen(line) + 1;
-  first = malloc(sizeof(LINE));
-  first->str = malloc(length*sizeof(char));
-  strcpy(first->str,line);
 
-  previous = first;
-  while (read_line(stream,line)==0) {
-    length = strlen(line) + 1;
-    previous->ptr = malloc(sizeof(LINE));
-    previous = previous->ptr;
-    previous->str = malloc(length*sizeof(char));
-    strcpy(previous->str,line);
+  // Otherwise read it
+
+  *mapped = 0;
+  size = READSIZE;
+  text = malloc(size);
+  *length = 0;
+  while ((n=fread(text+*length,1,size-*length,stream))>0) {
+    *length += n;
+    if (*length==size) {
+      size *= 2;
+      text = realloc(text,size);
+    }
+  }
+  if (*length==0) {
+    free(text);
+    return NULL;
   }
-  previous->ptr = NULL;          // Indicates last line
 
-  return 0;
+  return text;
 }
 
 
-// Function to free up the buffer again
+// Function to get the next token from the text.  Tokens are the brackets
+// "[" and "]", strings in double quotes, and words, which are anything
+// else that runs up to the next space or bracket.  Lines starting with "#"
+// are comments.  On return *start and *length give the text of a string
+// (without its quotes) or word.
 
-void free_buffer()
+int next_token(TEXT *t, char **start, size_t *length)
 {
-  LINE *thisptr;
-  LINE *nextptr;
+  char *p=t->ptr;
 
-  thisptr = first;
-  while (thisptr!=NULL) {
-    nextptr = thisptr->ptr;
-    free(thisptr->str);
-    free(thisptr);
-    thisptr = nextptr;
+  // Skip spaces and comments
+
+  for (;;) {
+    while ((p<t->end)&&((*p==' ')||(*p=='\t')||(*p=='\n')||(*p=='\r'))) p++;
+    if ((p<t->end)&&(*p=='#')) {
+      while ((p<t->end)&&(*p!='\n')) p++;
+    } else break;
+  }
+  if (p==t->end) {
+    t->ptr = p;
+    return TOKEN_END;
   }
-}
 
+  // Brackets
 
-// Function to reset to the start of the buffer again
+  if ((*p=='[')||(*p==']')) {
+    t->ptr = p + 1;
+    return *p=='[' ? TOKEN_OPEN : TOKEN_CLOSE;
+  }
 
-void reset_buffer()
-{
-  current = first;
-}
+  // Strings, which run to the closing quote regardless of line breaks
 
+  if (*p=='"') {
+    *start = ++p;
+    while ((p<t->end)&&(*p!='"')) p++;
+    *length = p - *start;
+    t->ptr = p<t->end ? p+1 : p;
+    return TOKEN_STRING;
+  }
 
-// Function to get the next line in the buffer.  Returns 0 if there was
-// a line or 1 if we've reached the end of the buffer.
+  // Words
 
-int next_line(char line[LINELENGTH])
-{
-  if (current==NULL) return 1;
-  strcpy(line,current->str);
-  current = current->ptr;
-  return 0;
+  *start = p;
+  while ((p<t->end)&&(*p!=' ')&&(*p!='\t')&&(*p!='\n')&&(*p!='\r')
+	 &&(*p!='[')&&(*p!=']')) p++;
+  *length = p - *start;
+  t->ptr = p;
+  return TOKEN_WORD;
 }
 
 
+// Function to check whether a token is a given key
 
-// Function to establish whether the network read from a given stream is
-// directed or not.  Returns 1 for a directed network, and 0 otherwise.  If
-// the GML file contains no "directed" line then the graph is assumed to be
-// undirected, which is the GML default behavior.
-
-int is_directed()
+int is_key(char *start, size_t length, char *key)
 {
-  int result=0;
-  char *ptr;
-  char line[LINELENGTH];
-
-  reset_buffer();
-
-  while (next_line(line)==0) {
-    ptr = strstr(line,"directed");
-    if (ptr==NULL) continue;
-    sscanf(ptr,"directed %i",&result);
-    break;
-  }
-
-  return result;
+  return (strlen(key)==length)&&(strncmp(start,key,length)==0);
 }
 
 
-// Function to count the vertices in a GML file.  Returns number of vertices.
+// Function to convert a token to a number.  Numbers with at most 19
+// significant digits and a power of ten no larger than 22 in size are
+// converted by hand, which gives the correctly rounded result when the
+// digits fit in a double; anything else is handed on to strtod().
+// Returns 0 if the token was a number, or 1 if not.
 
-int count_vertices()
+int read_number(char *start, size_t length, double *value)
 {
-  int result=0;
-  char *nonspace;
-  char line[LINELENGTH];
-
-  reset_buffer();
-
-  while (next_line(line)==0) {
-    for (nonspace=line; *nonspace==' '; nonspace++);
-    if (strncmp(nonspace,"node",4)==0) result++;
+  int negative=0;
+  int ndigits=0,nsignificant=0;
+  int exponent=0,e=0,esign=1;
+  unsigned long long mantissa=0;
+  double result;
+  char *p=start,*end=start+length;
+  char number[MAXNUMBER];
+  static const double power[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+				  1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14,
+				  1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+				  1e22 };
+
+  if ((p<end)&&((*p=='-')||(*p=='+'))) negative = (*p++=='-');
+  for (; (p<end)&&(*p>='0')&&(*p<='9'); p++, ndigits++) {
+    if ((mantissa>0)||(*p!='0')) nsignificant++;
+    mantissa = 10*mantissa + (*p-'0');
+  }
+  if ((p<end)&&(*p=='.')) {
+    for (p++; (p<end)&&(*p>='0')&&(*p<='9'); p++, ndigits++) {
+      if ((mantissa>0)||(*p!='0')) nsignificant++;
+      mantissa = 10*mantissa + (*p-'0');
+      exponent--;
+    }
+  }
+  if (ndigits==0) return 1;
+  if ((p<end)&&((*p=='e')||(*p=='E'))) {
+    p++;
+    if ((p<end)&&((*p=='-')||(*p=='+'))) esign = (*p++=='-') ? -1 : 1;
+    if ((p==end)||(*p<'0')||(*p>'9')) return 1;
+    for (; (p<end)&&(*p>='0')&&(*p<='9'); p++) if (e<10000) e = 10*e + (*p-'0');
+    exponent += esign*e;
+  }
+  if (p!=end) return 1;
+
+  if ((nsignificant<=19)&&(mantissa<=(1ULL<<53))
+      &&(exponent>=-22)&&(exponent<=22)) {
+    result = mantissa;
+    if (exponent<0) result /= power[-exponent];
+    else result *= power[exponent];
+  } else {
+    p = length<MAXNUMBER ? number : malloc(length+1);
+    memcpy(p,start,length);
+    p[length] = '\0';
+    result = strtod(p,NULL);
+    if (p!=number) free(p);
+    negative = 0;
   }
 
-  return result;
+  *value = negative ? -result : result;
+  return 0;
 }
 
 
-// Function to compare the IDs of two vertices
+// Function to convert a token to an integer.  Returns 0 if successful.
 
-int cmpid(VERTEX *v1p, VERTEX *v2p)
+int read_integer(char *start, size_t length, int *value)
 {
-  if (v1p->id>v2p->id) return 1;
-  if (v1p->id<v2p->id) return -1;
+  double x;
+
+  if (read_number(start,length,&x)!=0) return 1;
+  if ((x<-2147483648.0)||(x>2147483647.0)) return 1;
+  *value = (int)x;
   return 0;
 }
 
 
-// Function to allocate space for a network structure stored in a GML file
-// and determine the parameters (id, label) of each of the vertices.
+// Function to go through the text of a GML file once, picking out the
+// vertices and edges.  The file is a nested list of key-value pairs, where
+// a value can be a number, a string, or a list in square brackets; keys
+// we don't use are skipped along with their values.  If vertex and edge
+// are NULL the vertices and edges are only counted; otherwise the IDs and
+// labels of the vertices are stored in vertex[] and the edges, as pairs of
+// IDs, in edge[].  Edges lacking a source or target are left out, and
+// vertices without a label get the empty label.
 
-void create_network(NETWORK *network)
+void scan_text(char *text, size_t length, NETWORK *network, VERTEX *vertex,
+	       GMLEDGE *edge, int *nvertices, long *nedges)
 {
-  int i;
-  int length;
-  char *ptr;
-  char *start,*stop;
-  char *nonspace;
-  char line[LINELENGTH];
-  char label[LINELENGTH];
-
-  // Determine whether the network is directed
-
-  network->directed = is_directed();
-
-  // Count the vertices
-
-  network->nvertices = count_vertices();
-
-  // Make space for the vertices
-
-  network->vertex = calloc(network->nvertices,sizeof(VERTEX));
-
-  // Go through the file reading the details of each vertex one by one
-
-  reset_buffer();
-  for (i=0; i<network->nvertices; i++) {
-
-    // Skip to next "node" entry.  Check that the start of the line is "node"
-    // explicitly, to avoid other lines that might contain "node"
-
-    do {
-      next_line(line);
-      for (nonspace=line; *nonspace==' '; nonspace++);
-    } while (strncmp(nonspace,"node",4)!=0);
-
-    // Read in the details of this vertex
+  int type;
+  int depth=0;           // Number of lists we are inside
+  int inside=IN_NONE;       // Whether we are in a node or an edge
+  int itemdepth=0;       // Depth at which the node or edge began
+  int id;
+  char *key,*value;
+  size_t keylength,valuelength;
+  TEXT t;
+  VERTEX v;
+  GMLEDGE e;
+
+  t.ptr = text;
+  t.end = text + length;
+  *nvertices = 0;
+  *nedges = 0;
+  network->directed = 0;
+
+  while ((type=next_token(&t,&key,&keylength))!=TOKEN_END) {
+
+    // A closing bracket ends a list, and perhaps a node or edge
+
+    if (type==TOKEN_CLOSE) {
+      if ((inside==IN_NODE)&&(depth==itemdepth)) {
+	if (vertex!=NULL) {
+	  if (v.label<0) v.label = intern_label(network,"",0);
+	  vertex[*nvertices] = v;
+	}
+	(*nvertices)++;
+	inside = IN_NONE;
+      } else if ((inside==IN_EDGE)&&(depth==itemdepth)) {
+	if ((e.source>=0)&&(e.target>=0)) {
+	  if (edge!=NULL) edge[*nedges] = e;
+	  (*nedges)++;
+	}
+	inside = IN_NONE;
+      }
+      if (depth>0) depth--;
+      continue;
+    }
+    if (type==TOKEN_OPEN) {
+      depth++;
+      continue;
+    }
 
-    do {
+    // Otherwise we have a key, so get its value
 
-      // Skip leading spaces
+    type = next_token(&t,&value,&valuelength);
+    if (type==TOKEN_END) break;
+    if (type==TOKEN_CLOSE) {
+      t.ptr--;           // Let the loop above deal with it
+      continue;
+    }
 
-      for (nonspace=line; *nonspace==' '; nonspace++);
+    // Opening a list; see if it's a node or an edge
+
+    if (type==TOKEN_OPEN) {
+      depth++;
+      if (inside!=IN_NONE) continue;
+      if (is_key(key,keylength,"node")) {
+	inside = IN_NODE;
+	itemdepth = depth;
+	v.id = 0;
+	v.label = -1;
+      } else if (is_key(key,keylength,"edge")) {
+	inside = IN_EDGE;
+	itemdepth = depth;
+	e.source = e.target = -1;
+	e.weight = 1.0;
+      }
+      continue;
+    }
 
-      // Look for ID
+    // A plain value
 
-      if (strncmp(nonspace,"id",2)==0) {
-	sscanf(nonspace,"id %i",&network->vertex[i].id);
+    if (inside==IN_NONE) {
+      if (is_key(key,keylength,"directed")) {
+	read_integer(value,valuelength,&network->directed);
       }
-
-      // Look for label
-
-      if (strncmp(nonspace,"label",5)==0) {
-	start = strchr(line,'"');
-	if (start==NULL) {
-	  sscanf(nonspace,"label %s",&label);
-	} else {
-	  stop = strchr(++start,'"');
-	  if (stop==NULL) length = strlen(line) - (start-line);
-	  else length = stop - start;
-	  strncpy(label,start,length);
-	  label[length] = '\0';
-	  network->vertex[i].label = malloc((length+1)*sizeof(char));
-	  strcpy(network->vertex[i].label,label);
+    } else if (depth==itemdepth) {
+      if (inside==IN_NODE) {
+	if (is_key(key,keylength,"id")) {
+	  read_integer(value,valuelength,&v.id);
+	} else if (is_key(key,keylength,"label")&&(vertex!=NULL)) {
+	  v.label = intern_label(network,value,valuelength);
+	}
+      } else {
+	if (is_key(key,keylength,"source")) {
+	  if (read_integer(value,valuelength,&id)==0) e.source = id;
+	} else if (is_key(key,keylength,"target")) {
+	  if (read_integer(value,valuelength,&id)==0) e.target = id;
+	} else if (is_key(key,keylength,"value")) {
+	  read_number(value,valuelength,&e.weight);
 	}
       }
+    }
+  }
 
-      // If we see a closing square bracket we are done
-
-      if (strstr(line,"]")!=NULL) break;
-
-    } while (next_line(line)==0);
+  // A node left open at the end of the file still counts
 
+  if (inside==IN_NODE) {
+    if (vertex!=NULL) {
+      if (v.label<0) v.label = intern_label(network,"",0);
+      vertex[*nvertices] = v;
+    }
+    (*nvertices)++;
   }
+}
 
-  // Sort the vertices in increasing order of their IDs so we can find them
-  // quickly later
 
-  qsort(network->vertex,network->nvertices,sizeof(VERTEX),(void*)cmpid);
+// Function to compare the IDs of two vertices
+
+int cmpid(VERTEX *v1p, VERTEX *v2p)
+{
+  if (v1p->id>v2p->id) return 1;
+  if (v1p->id<v2p->id) return -1;
+  return 0;
 }
 
 
 // Function to find a vertex with a specified ID using binary search.
 // Returns the element in the vertex[] array holding the vertex in question,
-// or -1 if no vertex was found.
+// or -1 if no vertex was found.  IDs are very often consecutive, so we
+// check first if the vertex is where it would be if they were.
 
 int find_vertex(int id, NETWORK *network)
 {
   int top,bottom,split;
   int idsplit;
+  long guess;
 
   top = network->nvertices;
   if (top<1) return -1;
+  guess = (long)id - network->vertex[0].id;
+  if ((guess>=0)&&(guess<top)&&(network->vertex[guess].id==id)) return guess;
   bottom = 0;
   split = top/2;
 
@@ -287,143 +436,488 @@ int find_vertex(int id, NETWORK *network)
 
   return -1;
 }
-    
 
-// Function to determine the degrees of all the vertices by going through
-// the edge data
 
-void get_degrees(NETWORK *network)
+// Function to put the edges into the network, in the order they appeared
+// in the file.  Returns 1 if an edge refers to a nonexistent vertex.
+
+int make_edges(NETWORK *network, GMLEDGE *gmledge, long ngmledges)
 {
-  int s,t;
+  int i;
   int vs,vt;
-  char *ptr;
-  char line[LINELENGTH];
+  long j;
+  int *count;
 
-  reset_buffer();
+  // Turn the IDs into indices and work out the degrees
 
-  while (next_line(line)==0) {
+  for (j=0; j<ngmledges; j++) {
+    vs = find_vertex(gmledge[j].source,network);
+    vt = find_vertex(gmledge[j].target,network);
+    if ((vs<0)||(vt<0)) {
+      fprintf(stderr,"Edge %i -- %i refers to a vertex that doesn't exist\n",
+	      gmledge[j].source,gmledge[j].target);
+      return 1;
+    }
+    gmledge[j].source = vs;
+    gmledge[j].target = vt;
+    network->vertex[vs].degree++;
+    if (network->directed==0) network->vertex[vt].degree++;
+  }
 
-    // Find the next edge entry
+  // Malloc space for the edges, in a single block with each vertex's
+  // edges stored contiguously, and temporary space for the edge counts
+  // at each vertex
 
-    ptr = strstr(line,"edge");
-    if (ptr==NULL) continue;
+  network->nedges = 0;
+  for (i=0; i<network->nvertices; i++) {
+    network->vertex[i].offset = network->nedges;
+    network->nedges += network->vertex[i].degree;
+  }
+  network->edge = malloc(network->nedges*sizeof(EDGE));
+  for (i=0; i<network->nvertices; i++) {
+    network->vertex[i].edge = network->edge + network->vertex[i].offset;
+  }
+  count = calloc(network->nvertices,sizeof(int));
 
-    // Read the source and target of the edge
+  // Add the edges to the appropriate vertices
+
+  for (j=0; j<ngmledges; j++) {
+    vs = gmledge[j].source;
+    vt = gmledge[j].target;
+    network->vertex[vs].edge[count[vs]].target = vt;
+    network->vertex[vs].edge[count[vs]].weight = gmledge[j].weight;
+    network->vertex[vs].edge[count[vs]].multiplicity = 1;
+    count[vs]++;
+    if (network->directed==0) {
+      network->vertex[vt].edge[count[vt]].target = vs;
+      network->vertex[vt].edge[count[vt]].weight = gmledge[j].weight;
+      network->vertex[vt].edge[count[vt]].multiplicity = 1;
+      count[vt]++;
+    }
+  }
 
-    s = t = -1;
+  free(count);
+  return 0;
+}
 
-    do {
 
-      ptr = strstr(line,"source");
-      if (ptr!=NULL) sscanf(ptr,"source %i",&s);
-      ptr = strstr(line,"target");
-      if (ptr!=NULL) sscanf(ptr,"target %i",&t);
+// Function to find the reverse of each edge, meaning for the edge from u
+// to v the position in v's list of the edge that leads back from v to u,
+// and to count the number of edges joining each pair of vertices, and
+// with it the degree of each vertex, taking multiplicities into account.  Takes
+// time linear in the number of edges: edges are first bucketed by their
+// targets, then each vertex pairs its incoming edges with its own outgoing
+// ones.  A self-edge appears twice in its vertex's list and the two copies
+// get matched with one another.  Edges with no reverse (which can happen
+// in directed networks) get twin -1.
 
-      // If we see a closing square bracket we are done
+void find_twins(NETWORK *network)
+{
+  int u,v,i,j;
+  long k;
+  long nedges;
+  int maxdegree;
+  long *start;           // Start of each vertex's list of incoming edges
+  long *fill;            // Next free slot in each list of incoming edges
+  int *insource;         // Source of each incoming edge
+  int *inindex;          // Position of each incoming edge in its source list
+  int *head;             // Last outgoing edge to each target
+  int *next;             // Previous outgoing edge to the same target
+  int *count;            // Number of outgoing edges to each target
+  VERTEX *vertex=network->vertex;
+
+  if (network->nvertices<1) return;      // Nothing to do
+
+  // Make space
+
+  for (u=maxdegree=0,nedges=0; u<network->nvertices; u++) {
+    nedges += vertex[u].degree;
+    if (vertex[u].degree>maxdegree) maxdegree = vertex[u].degree;
+    vertex[u].multidegree = 0;
+    for (i=0; i<vertex[u].degree; i++) {
+      vertex[u].multidegree += vertex[u].edge[i].multiplicity;
+    }
+  }
+  start = calloc(network->nvertices+1,sizeof(long));
+  fill = malloc(network->nvertices*sizeof(long));
+  insource = malloc(nedges*sizeof(int));
+  inindex = malloc(nedges*sizeof(int));
+  head = malloc(network->nvertices*sizeof(int));
+  next = malloc(maxdegree*sizeof(int));
+  count = calloc(network->nvertices,sizeof(int));
 
-      if (strstr(line,"]")!=NULL) break;
+  // Bucket the edges by target.  Each bucket ends up sorted by source.
 
-    } while (next_line(line)==0);
+  for (u=0; u<network->nvertices; u++) {
+    for (i=0; i<vertex[u].degree; i++) start[vertex[u].edge[i].target+1]++;
+  }
+  for (v=0; v<network->nvertices; v++) {
+    start[v+1] += start[v];
+    fill[v] = start[v];
+    head[v] = -1;
+  }
+  for (u=0; u<network->nvertices; u++) {
+    for (i=0; i<vertex[u].degree; i++) {
+      k = fill[vertex[u].edge[i].target]++;
+      insource[k] = u;
+      inindex[k] = i;
+    }
+  }
 
-    // Increment the degrees of the appropriate vertex or vertices
+  // Go through the vertices, matching incoming to outgoing edges
 
-    if ((s>=0)&&(t>=0)) {
-      vs = find_vertex(s,network);
-      network->vertex[vs].degree++;
-      if (network->directed==0) {
-	vt = find_vertex(t,network);
-	network->vertex[vt].degree++;
-      }
+  for (v=0; v<network->nvertices; v++) {
+    for (j=0; j<vertex[v].degree; j++) {
+      u = vertex[v].edge[j].target;
+      next[j] = head[u];
+      head[u] = j;
+      count[u] += vertex[v].edge[j].multiplicity;
+    }
+    for (k=start[v]; k<start[v+1]; k++) {
+      u = insource[k];
+      i = inindex[k];
+      j = head[u];
+      if (j>=0) head[u] = next[j];
+      vertex[u].edge[i].twin = j;
+      vertex[u].edge[i].parallel = count[u];
+    }
+    for (j=0; j<vertex[v].degree; j++) {
+      u = vertex[v].edge[j].target;
+      head[u] = -1;
+      count[u] = 0;
     }
-
   }
 
-  return;
+  free(start);
+  free(fill);
+  free(insource);
+  free(inindex);
+  free(head);
+  free(next);
+  free(count);
 }
 
 
-// Function to read in the edges
+// Function to merge parallel edges.  Each vertex's list is compacted in
+// place, keeping the first of each set of parallel edges where it was,
+// and adding the multiplicities and weights of the others to it.  The
+// lists are also moved down so they stay contiguous, which is safe because
+// nothing is ever written beyond the point we have read up to.  If the
+// edges are in a mapped snapshot they are copied out of it first.
 
-void read_edges(NETWORK *network)
+void merge_edges(NETWORK *network)
 {
-  int i;
-  int s,t;
-  int vs,vt;
-  int *count;
-  double w;
-  char *ptr;
-  char line[LINELENGTH];
+  int u,v,i,j;
+  int degree;
+  long n,start;
+  int *slot;             // Position in u's list of the edge to each vertex
+  EDGE *old;
+
+  if (network->map!=NULL) {
+    old = network->edge;
+    network->edge = malloc(network->nedges*sizeof(EDGE));
+    memcpy(network->edge,old,network->nedges*sizeof(EDGE));
+    for (u=0; u<network->nvertices; u++) {
+      network->vertex[u].edge = network->edge + network->vertex[u].offset;
+    }
+  }
 
-  // Malloc space for the edges and temporary space for the edge counts
-  // at each vertex
+  slot = malloc(network->nvertices*sizeof(int));
+  for (v=0; v<network->nvertices; v++) slot[v] = -1;
+
+  for (u=n=0; u<network->nvertices; u++) {
+    old = network->vertex[u].edge;
+    start = n;
+    degree = 0;
+    for (i=0; i<network->vertex[u].degree; i++) {
+      v = old[i].target;
+      j = slot[v];
+      if (j<0) {
+	slot[v] = degree++;
+	network->edge[n++] = old[i];
+      } else {
+	network->edge[start+j].multiplicity += old[i].multiplicity;
+	network->edge[start+j].weight += old[i].weight;
+      }
+    }
+    for (i=0; i<degree; i++) slot[network->edge[start+i].target] = -1;
+    network->vertex[u].offset = start;
+    network->vertex[u].degree = degree;
+  }
+  free(slot);
 
-  for (i=0; i<network->nvertices; i++) {
-    network->vertex[i].edge = malloc(network->vertex[i].degree*sizeof(EDGE));
+  // Shrink the block and find the new reverse edges
+
+  network->nedges = n;
+  network->edge = realloc(network->edge,n*sizeof(EDGE));
+  for (u=0; u<network->nvertices; u++) {
+    network->vertex[u].edge = network->edge + network->vertex[u].offset;
   }
-  count = calloc(network->nvertices,sizeof(int));
+  find_twins(network);
+}
+
+// Function to add and remove edges.  add[] holds nadd pairs of vertices
+// to join, as add[2*i] and add[2*i+1], and remove[] nremove pairs to
+// disconnect.  Removing an edge that stands for several merged parallel
+// edges takes one off its multiplicity.  Each vertex keeps its remaining
+// edges in the same order, followed by its new ones.  Returns an array
+// giving, for each edge of the changed network, its position in the old
+// one, or -1 if it is new.  If any of the edges to be removed does not
+// exist, the network is left as it was and NULL is returned.
+
+long *change_edges(NETWORK *network, int *add, int nadd, int *remove,
+		   int nremove)
+{
+  int u,v,i,j,m;
+  long e,f;
+  long *oldpos;
+  long *fill;            // Next free place in each vertex's new list
+  int *taken;            // Multiplicity taken off each edge
+  VERTEX *vertex=network->vertex;
+  EDGE *edge;
+
+  // Find the edges to remove, taking one off the multiplicity of the edge
+  // from u to v and of its twin
+
+  taken = calloc(network->nedges,sizeof(int));
+  for (j=0; j<nremove; j++) {
+    u = remove[2*j];
+    v = remove[2*j+1];
+    for (i=0,e=vertex[u].offset; i<vertex[u].degree; i++,e++) {
+      if ((network->edge[e].target==v)&&(network->edge[e].twin>=0)
+	  &&(network->edge[e].multiplicity>taken[e])) break;
+    }
+    if (i==vertex[u].degree) {
+      free(taken);
+      return NULL;
+    }
+    taken[e]++;
+    taken[vertex[v].offset+network->edge[e].twin]++;
+  }
+
+  // Work out where each vertex's new list starts, using fill[] to count
+  // the edges of each vertex first
 
-  // Read in the data
+  fill = calloc(network->nvertices+1,sizeof(long));
+  for (u=0; u<network->nvertices; u++) {
+    for (i=0; i<vertex[u].degree; i++) {
+      e = vertex[u].offset + i;
+      if (network->edge[e].multiplicity>taken[e]) fill[u+1]++;
+    }
+  }
+  for (j=0; j<nadd; j++) {
+    fill[add[2*j]+1]++;
+    fill[add[2*j+1]+1]++;
+  }
+  for (u=0; u<network->nvertices; u++) fill[u+1] += fill[u];
+  edge = malloc(fill[network->nvertices]*sizeof(EDGE));
+  oldpos = malloc(fill[network->nvertices]*sizeof(long));
+
+  // Copy the remaining edges, with what is left of their multiplicities
+  // and a matching share of their weights, then add the new ones
+
+  for (u=0; u<network->nvertices; u++) {
+    f = fill[u];
+    for (i=0; i<vertex[u].degree; i++) {
+      e = vertex[u].offset + i;
+      m = network->edge[e].multiplicity;
+      if (m<=taken[e]) continue;
+      edge[f] = network->edge[e];
+      edge[f].multiplicity = m - taken[e];
+      edge[f].weight *= (double)(m-taken[e])/m;
+      oldpos[f++] = e;
+    }
+    vertex[u].offset = fill[u];
+    vertex[u].degree = f - fill[u];
+    fill[u] = f;
+  }
+  for (j=0; j<2*nadd; j++) {
+    u = add[j];
+    f = fill[u]++;
+    edge[f].target = add[j^1];
+    edge[f].multiplicity = 1;
+    edge[f].weight = 1.0;
+    oldpos[f] = -1;
+    vertex[u].degree++;
+  }
+  free(taken);
 
-  reset_buffer();
+  // Replace the old block, unless it's in a mapped snapshot, and find the
+  // new reverse edges
 
-  while (next_line(line)==0) {
+  if ((network->map==NULL)||((char*)network->edge<network->map)
+      ||((char*)network->edge>=network->map+network->maplength)) {
+    free(network->edge);
+  }
+  network->edge = edge;
+  network->nedges = fill[network->nvertices-1];
+  for (u=0; u<network->nvertices; u++) {
+    vertex[u].edge = network->edge + vertex[u].offset;
+  }
+  free(fill);
+  find_twins(network);
 
-    // Find the next edge entry
+  return oldpos;
+}
 
-    ptr = strstr(line,"edge");
-    if (ptr==NULL) continue;
 
-    // Read the source and target of the edge and the edge weight
+// Function to add n new vertices, with the given labels and no edges,
+// numbered after the existing ones.  Their IDs follow on from the largest
+// ID in the network.  Edges to them can be added with change_edges().
 
-    s = t = -1;
-    w = 1.0;
+void add_vertices(NETWORK *network, int n, char **label)
+{
+  int u,i,id;
 
-    do {
+  for (u=id=0; u<network->nvertices; u++) {
+    if (network->vertex[u].id>=id) id = network->vertex[u].id + 1;
+  }
+  network->vertex = realloc(network->vertex,
+			    (network->nvertices+n)*sizeof(VERTEX));
+  for (i=0; i<n; i++) {
+    u = network->nvertices + i;
+    network->vertex[u].id = id + i;
+    network->vertex[u].degree = 0;
+    network->vertex[u].multidegree = 0;
+    network->vertex[u].label = intern_label(network,label[i],
+					    strlen(label[i]));
+    network->vertex[u].offset = network->nedges;
+    network->vertex[u].edge = network->edge + network->nedges;
+  }
+  network->nvertices += n;
+}
 
-      ptr = strstr(line,"source");
-      if (ptr!=NULL) sscanf(ptr,"source %i",&s);
-      ptr = strstr(line,"target");
-      if (ptr!=NULL) sscanf(ptr,"target %i",&t);
-      ptr = strstr(line,"value");
-      if (ptr!=NULL) sscanf(ptr,"value %lf",&w);
 
-      // If we see a closing square bracket we are done
+// Function to calculate the hash of a label
 
-      if (strstr(line,"]")!=NULL) break;
+unsigned long hash_label(char *text, size_t length)
+{
+  size_t i;
+  unsigned long h=14695981039346656037UL;
+
+  for (i=0; i<length; i++) {
+    h ^= (unsigned char)text[i];
+    h *= 1099511628211UL;
+  }
+  return h;
+}
 
-    } while (next_line(line)==0);
 
-    // Add these edges to the appropriate vertices
+// Function to find a label in the table, adding it if it isn't there.
+// The hash table holds indices into network->label[], or -1 for empty
+// slots, and is doubled in size when it becomes half full.
 
-    if ((s>=0)&&(t>=0)) {
-      vs = find_vertex(s,network);
-      vt = find_vertex(t,network);
-      network->vertex[vs].edge[count[vs]].target = vt;
-      network->vertex[vs].edge[count[vs]].weight = w;
-      count[vs]++;
-      if (network->directed==0) {
-	network->vertex[vt].edge[count[vt]].target = vs;
-	network->vertex[vt].edge[count[vt]].weight = w;
-	count[vt]++;
-      }
+int intern_label(NETWORK *network, char *text, size_t length)
+{
+  int i,j;
+  int mask;
+  char *s;
+
+  // Make the hash table the first time we're called, or bigger if needed.
+  // It can be made again after finish_labels() for a network that already
+  // has labels, so it starts big enough to hold them.
+
+  if ((network->labelhash==NULL)||(2*network->nlabels>=network->hashsize)) {
+    if (network->labelhash==NULL) {
+      for (network->hashsize=HASHSIZE; 2*network->nlabels>=network->hashsize;
+	   network->hashsize*=2);
+    } else network->hashsize *= 2;
+    free(network->labelhash);
+    network->labelhash = malloc(network->hashsize*sizeof(int));
+    mask = network->hashsize - 1;
+    for (j=0; j<network->hashsize; j++) network->labelhash[j] = -1;
+    for (i=0; i<network->nlabels; i++) {
+      s = network->label[i];
+      for (j=hash_label(s,strlen(s))&mask; network->labelhash[j]>=0;
+	   j=(j+1)&mask);
+      network->labelhash[j] = i;
     }
+    network->label = realloc(network->label,
+			     network->hashsize/2*sizeof(char*));
+  }
+
+  // Look for the label
 
+  mask = network->hashsize - 1;
+  for (j=hash_label(text,length)&mask; network->labelhash[j]>=0;
+       j=(j+1)&mask) {
+    s = network->label[network->labelhash[j]];
+    if ((strncmp(s,text,length)==0)&&(s[length]=='\0')) {
+      return network->labelhash[j];
+    }
   }
 
-  free(count);
-  return;
+  // It's new, so add it
+
+  s = malloc(length+1);
+  memcpy(s,text,length);
+  s[length] = '\0';
+  network->label[network->nlabels] = s;
+  network->labelhash[j] = network->nlabels;
+  return network->nlabels++;
 }
 
 
-// Function to read a complete network
+// Function to free the hash table when we're done reading
+
+void finish_labels(NETWORK *network)
+{
+  free(network->labelhash);
+  network->labelhash = NULL;
+  network->hashsize = 0;
+}
+
+
+// Function to read a complete network.  The first pass over the text
+// counts the vertices and edges, and the second reads them into arrays of
+// exactly the right size.
 
 int read_network(NETWORK *network, FILE *stream)
 {
-  fill_buffer(stream);
-  create_network(network);
-  get_degrees(network);
-  read_edges(network);
-  free_buffer();
+  int mapped;
+  int nvertices;
+  long ngmledges;
+  size_t length;
+  char *text;
+  GMLEDGE *gmledge;
+
+  network->nvertices = 0;
+  network->nedges = 0;
+  network->directed = 0;
+  network->vertex = NULL;
+  network->edge = NULL;
+  network->map = NULL;
+  network->maplength = 0;
+  network->nlabels = 0;
+  network->label = NULL;
+  network->labelhash = NULL;
+  network->hashsize = 0;
+
+  text = load_text(stream,&length,&mapped);
+  if (text==NULL) return 0;
+
+  scan_text(text,length,network,NULL,NULL,&nvertices,&ngmledges);
+  network->nvertices = nvertices;
+  network->vertex = calloc(nvertices,sizeof(VERTEX));
+  gmledge = malloc(ngmledges*sizeof(GMLEDGE));
+  scan_text(text,length,network,network->vertex,gmledge,
+	    &nvertices,&ngmledges);
+
+  if (mapped) munmap(text,length);
+  else free(text);
+  finish_labels(network);
+
+  // Sort the vertices in increasing order of their IDs so we can find them
+  // quickly
+
+  qsort(network->vertex,network->nvertices,sizeof(VERTEX),(void*)cmpid);
+
+  if (make_edges(network,gmledge,ngmledges)!=0) {
+    free(gmledge);
+    return 1;
+  }
+  free(gmledge);
+  find_twins(network);
 
   return 0;
 }
@@ -435,9 +929,24 @@ void free_network(NETWORK *network)
 {
   int i;
 
-  for (i=0; i<network->nvertices; i++) {
-    free(network->vertex[i].edge);
-    free(network->vertex[i].label);
-  }
   free(network->vertex);
+  free(network->labelhash);
+  if (network->map!=NULL) {
+    if (((char*)network->edge<network->map)
+	||((char*)network->edge>=network->map+network->maplength)) {
+      free(network->edge);             // Copied out by merge_edges()
+    }
+    for (i=0; i<network->nlabels; i++) {
+      if ((network->label[i]<network->map)
+	  ||(network->label[i]>=network->map+network->maplength)) {
+	free(network->label[i]);       // Added by intern_label()
+      }
+    }
+    free(network->label);
+    munmap(network->map,network->maplength);
+    return;
+  }
+  for (i=0; i<network->nlabels; i++) free(network->label[i]);
+  free(network->label);
+  free(network->edge);
 }
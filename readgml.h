@@ -9,6 +9,18 @@
 #include "network.h"
 
 int read_network(NETWORK *network, FILE *stream);
+void merge_edges(NETWORK *network);
+long *change_edges(NETWORK *network, int *add, int nadd, int *remove,
+		   int nremove);
+void add_vertices(NETWORK *network, int n, char **label);
 void free_network(NETWORK *network);
 
+// Also used by the other readers
+
+int read_number(char *start, size_t length, double *value);
+int find_vertex(int id, NETWORK *network);
+void find_twins(NETWORK *network);
+int intern_label(NETWORK *network, char *text, size_t length);
+void finish_labels(NETWORK *network);
+
 #endif
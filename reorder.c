@@ -0,0 +1,175 @@
+// Functions to renumber the vertices of a network so that vertices that
+// are joined by edges are close together in memory.  The order in which
+// vertices are read is whatever order their IDs happened to have, which is
+// often no better than random, so that the neighbors of a vertex, and the
+// messages on their edges, are scattered all over memory.  Three orders
+// are offered:
+//
+//   REORDER_DEGREE  Vertices in decreasing order of degree, which puts the
+//                   hubs, whose edges are read most often, together
+//   REORDER_BFS     Breadth-first search from a vertex of lowest degree in
+//                   each component, so that each vertex is near the
+//                   vertices it was found from
+//   REORDER_RCM     Reverse Cuthill-McKee: breadth-first search visiting
+//                   the neighbors of each vertex in increasing order of
+//                   degree, then reversed, which keeps the edges close to
+//                   the diagonal of the adjacency matrix
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "reorder.h"
+
+
+// Function to put the vertices v[0..n-1] in increasing order of degree by
+// insertion sort, which is quick for the short lists it is used on.  Ties
+// keep their order.
+
+void sort_by_degree(NETWORK *network, int *v, int n)
+{
+  int i,j,w;
+
+  for (i=1; i<n; i++) {
+    w = v[i];
+    for (j=i; (j>0)&&(network->vertex[v[j-1]].degree
+		      >network->vertex[w].degree); j--) v[j] = v[j-1];
+    v[j] = w;
+  }
+}
+
+
+// Function to do the breadth-first searches for REORDER_BFS and
+// REORDER_RCM.  Each component is searched from its vertex of lowest
+// degree (and lowest number among those), with the components taken in
+// order of those vertices.  With bydegree set, each vertex's new
+// neighbors are queued in increasing order of degree.
+
+void search_order(NETWORK *network, int *order, int bydegree)
+{
+  int n=network->nvertices;
+  int u,v,i,j,d;
+  int head,tail,start;
+  int *byd,*count;
+  char *seen;
+
+  // Counting sort the vertices by degree, to find the starting vertices
+
+  for (u=d=0; u<n; u++) {
+    if (network->vertex[u].degree>d) d = network->vertex[u].degree;
+  }
+  count = calloc(d+2,sizeof(int));
+  for (u=0; u<n; u++) count[network->vertex[u].degree+1]++;
+  for (i=0; i<=d; i++) count[i+1] += count[i];
+  byd = malloc(n*sizeof(int));
+  for (u=0; u<n; u++) byd[count[network->vertex[u].degree]++] = u;
+  free(count);
+
+  seen = calloc(n,sizeof(char));
+  for (j=tail=0; j<n; j++) {
+    start = byd[j];
+    if (seen[start]) continue;
+    seen[start] = 1;
+    order[tail++] = start;
+    for (head=tail-1; head<tail; head++) {
+      u = order[head];
+      i = tail;
+      for (d=0; d<network->vertex[u].degree; d++) {
+	v = network->vertex[u].edge[d].target;
+	if (!seen[v]) {
+	  seen[v] = 1;
+	  order[tail++] = v;
+	}
+      }
+      if (bydegree) sort_by_degree(network,order+i,tail-i);
+    }
+  }
+
+  free(seen);
+  free(byd);
+}
+
+
+// Function to choose a new order for the vertices.  Returns an array
+// order[] with order[i] the current number of the vertex that should be
+// numbered i, or NULL for REORDER_NONE
+
+int *network_order(NETWORK *network, int method)
+{
+  int n=network->nvertices;
+  int u,i,d;
+  int *order,*count;
+
+  if (method==REORDER_NONE) return NULL;
+  order = malloc(n*sizeof(int));
+
+  switch (method) {
+  case REORDER_DEGREE:
+    for (u=d=0; u<n; u++) {
+      if (network->vertex[u].degree>d) d = network->vertex[u].degree;
+    }
+    count = calloc(d+2,sizeof(int));
+    for (u=0; u<n; u++) count[d-network->vertex[u].degree+1]++;
+    for (i=0; i<=d; i++) count[i+1] += count[i];
+    for (u=0; u<n; u++) order[count[d-network->vertex[u].degree]++] = u;
+    free(count);
+    break;
+  case REORDER_BFS:
+    search_order(network,order,0);
+    break;
+  case REORDER_RCM:
+    search_order(network,order,1);
+    for (i=0; i<n/2; i++) {
+      u = order[i];
+      order[i] = order[n-1-i];
+      order[n-1-i] = u;
+    }
+    break;
+  }
+
+  return order;
+}
+
+
+// Function to renumber the vertices in the given order, as returned by
+// network_order().  Each vertex keeps its edges, in the same order, so
+// only their targets change and not their twins.  The new block of edges
+// replaces the old one, or is allocated outside the snapshot if the old
+// one is in a mapped snapshot, as in merge_edges().
+
+void reorder_network(NETWORK *network, int *order)
+{
+  int n=network->nvertices;
+  int u,i;
+  int *rank;
+  long e;
+  VERTEX *vertex;
+  EDGE *edge;
+
+  rank = malloc(n*sizeof(int));
+  for (i=0; i<n; i++) rank[order[i]] = i;
+
+  vertex = malloc(n*sizeof(VERTEX));
+  edge = malloc(network->nedges*sizeof(EDGE));
+  for (i=e=0; i<n; i++) {
+    u = order[i];
+    vertex[i] = network->vertex[u];
+    vertex[i].offset = e;
+    vertex[i].edge = edge + e;
+    memcpy(vertex[i].edge,network->vertex[u].edge,
+	   vertex[i].degree*sizeof(EDGE));
+    for (e=vertex[i].offset; e<vertex[i].offset+vertex[i].degree; e++) {
+      edge[e].target = rank[edge[e].target];
+    }
+  }
+
+  if ((network->map==NULL)
+      ||(((char*)network->edge<network->map)
+	 ||((char*)network->edge>=network->map+network->maplength))) {
+    free(network->edge);
+  }
+  free(network->vertex);
+  network->vertex = vertex;
+  network->edge = edge;
+  free(rank);
+}
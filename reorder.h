@@ -0,0 +1,16 @@
+// Header file for renumbering the vertices of a network for locality
+
+#ifndef _REORDER_H
+#define _REORDER_H
+
+#include "network.h"
+
+#define REORDER_NONE 0     // Orders, as described in reorder.c
+#define REORDER_DEGREE 1
+#define REORDER_BFS 2
+#define REORDER_RCM 3
+
+int *network_order(NETWORK *network, int method);
+void reorder_network(NETWORK *network, int *order);
+
+#endif
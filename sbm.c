@@ -0,0 +1,3485 @@
+/* Library to perform K-group EM/BP community detection using the
+ * degree-corrected SBM on an arbitrary network with discrete (categorical)
+ * metadata.  All the state of a calculation is kept in a context of type
+ * SBM, so that several calculations can go at once on different threads.
+ * See sbm.h for how to use it.
+ *
+ * Written by Mark Newman  28 NOV 2014
+ * Made into a library  17 OCT 26
+ */
+
+/* Program control */
+
+/* Inclusions */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <sched.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include <gsl/gsl_rng.h>
+#include "sbm.h"
+#include "readgml.h"
+#include "readedges.h"
+#include "snapshot.h"
+#include "reorder.h"
+#include "vecmath.h"
+
+/* Constants */
+
+#define KDEFAULT 2     // Default number of groups
+
+#define BP_ACC 1e-4    // Required accuracy for BP to terminate
+#define EM_ACC 1e-4    // Required accuracy for EM to terminate
+
+#define NOCONVERGE     // Set to abort if the solution doesn't converge
+#define BP_MAXSTEP 20  // Maximum number of BP steps before aborting
+#define EM_MAXSTEP 100 // Maximum number of EM steps before aborting
+
+#define SMALL 1.0e-100
+
+#define PRUNE_MINSTEP 3 // EM steps before a losing run can be abandoned
+#define PRUNE_MARGIN 1e-3 // Relative margin by which it must be losing
+
+#define VBUF 4096      // Number of values in a batch of logs or exps
+
+#define MAXPRINT 20    // Most metadata values to print in progress reports
+
+#define BLOCKSIZE 4096 // Target number of vertices plus edges per block of
+                       //   work handed to a thread
+
+typedef struct checkpoint CHECKPOINT;
+
+/* Barrier for the processes of a multi-process run, kept in memory they
+ * share */
+
+typedef struct {
+  int count;           // Number of processes waiting at it
+  int generation;      // Number of times it has been passed
+} SYNC;
+
+/* Records of one BP sweep (or one round of the residual schedule) and of
+ * one EM step, kept for the statistics written by sbm_write_stats() */
+
+typedef struct {
+  double wall;         // Wall-clock time it took
+  double maxdelta;     // Largest change in any message
+} SWEEP;
+
+typedef struct {
+  int bpsteps;         // Number of BP steps
+  long firstsweep;     // Its first sweep in the state's list of sweeps
+  long updates;        // Number of message updates
+  double bpwall;       // Wall-clock and CPU time for BP
+  double bpcpu;
+  double paramswall;   // Wall-clock and CPU time for the parameters
+  double paramscpu;
+  double change;       // Largest change in any of the c's
+  double L;            // Log-likelihood
+} EMSTEP;
+
+/* A fitted model read by sbm_read_model(), whose parameters are used in
+ * place of fitted ones.  The metadata values are kept in alphabetical
+ * order of their labels, for looking them up. */
+
+typedef struct {
+  char *label;         // Label of the metadata value
+  double *gmma;        // Its prior parameters, K of them
+} MVALUE;
+
+typedef struct {
+  int K;               // Number of groups
+  int nvalues;         // Number of metadata values
+  double *c;           // Mixing parameters times twice the number of edges,
+                       //   which don't depend on the size of the network
+  MVALUE *value;       // The metadata values
+  double *gmma;        // Their priors, all in one block
+  double *prior;       // Priors for values not in the model, the fraction
+                       //   of all vertices in each group
+} MODEL;
+
+/* State of one run of the EM algorithm.  Runs share the network and the
+ * metadata in their context, which are only read, but each has its own
+ * parameters, messages, and random number generator, so several can go at
+ * once */
+
+typedef struct {
+  SBM *sbm;            // Context the run belongs to
+
+  double **gmma;       // Prior parameters (spelled "gmma" because "gamma"
+                       //   is a reserved word in C math.h)
+  double **nrx;        // Expected number in each group with each value
+  double *omega;       // Mixing parameters, omega[K*r+s]
+
+  void *eta;           // Messages, K for each edge in the order of G.edge,
+                       //   stored with the state's precision
+  double *q;           // One-point marginals, K for each vertex
+  double *field;       // Log-fields of the vertices, less the clamped terms
+  int *nsmall;         // Number of clamped terms in each field
+  void *logterm;       // Log-contribution of each message to its field,
+                       //   stored as doubles or, for lower precisions, floats
+  double *partial;     // Per-block partial results for reductions
+  double *loggmma;     // Logs of the gammas, loggmma[K*i+r]
+
+  double *residual;    // Residual of each message (residual BP only)
+  long *heap;          // Heap of edges by residual (residual BP only)
+  long *heappos;       // Position of each edge in the heap
+  long updates;        // Number of message updates
+  long sweeps;         // Number of BP sweeps, or rounds of the residual
+                       //   schedule
+
+  gsl_rng *rng;        // Random number generator
+  unsigned long seed;  // Seed it was started from
+
+  int emsteps;         // Number of EM steps taken
+  int bpsteps;         // Number of BP steps on the last EM step
+  double tbp;          // Seconds spent in BP
+  double tparams;      // Seconds spent calculating the parameters
+  double initwall;     // Wall-clock and CPU time to set up the state
+  double initcpu;
+  double L;            // Log-likelihood
+  double Lhist[3];     // Log-likelihoods of the last three EM steps
+  int fixed;           // Set if the parameters are fixed by a model
+  int K;               // Number of groups
+  int nvertices;       // Number of vertices and of metadata values when
+  int nmlabels;        //   the state was made, which its arrays are sized for
+  size_t partialsize;  // Size in bytes of partial[]
+  int precision;       // How eta and logterm are stored, SBM_DOUBLE etc.
+  int outofcore;       // Set if eta and logterm are in files in scratch
+  int mapped;          // Set if they are mapped rather than allocated
+  size_t etasize;      // Their sizes in bytes
+  size_t termsize;
+
+  int shared;          // Set if the arrays are shared with other processes
+  SYNC *sync;          // Barrier for the processes
+  int rank;            // Which process this is, numbered from zero
+  int nprocs;          // Number of processes
+  pid_t parent;        // Process ID of process zero
+  int vb0,vb1;         // Blocks of vertices and of edges, and the metadata
+  int eb0,eb1;         //   values, that this process works on
+  int x0,x1;
+
+  SWEEP *sweep;        // Record of each BP sweep
+  long nsweep;         // Number of sweeps recorded
+  long sweepspace;     // Number there is room for
+  EMSTEP *step;        // Record of each EM step
+  int nstep;
+  int stepspace;
+} STATE;
+
+/* A context, holding the network, the metadata, the options, and the
+ * results of the best run */
+
+struct sbm {
+  NETWORK G;           // Struct storing the network
+  int loaded;          // Set once the network has been read
+  int ready;           // Set once the metadata and blocks have been made
+  long twom;           // Twice the number of edges
+  int *order;          // Original number of each vertex, if they have been
+                       //   renumbered for locality, else NULL
+  int *rank;           // Current number of each vertex by original number
+
+  int *x;              // Metadata
+  int *nx;             // Number of nodes with each distinct metadata value
+  int *xstart;         // Start of each metadata value's list in xvertex[]
+  int *xvertex;        // Vertices in order of their metadata values
+  char **mlabel;       // Metadata strings
+  int nmlabels;        // Number of distinct metadata strings
+
+  int nvblocks;        // Number of blocks of vertices
+  int *vblock;         // First vertex in each block, plus one at the end
+  int neblocks;        // Number of blocks of edges
+  long *eblock;        // First edge in each block, plus one at the end
+  int *eblockvertex;   // Vertex that the first edge in each block belongs to
+  int *esource;        // Vertex each edge belongs to (residual BP only)
+
+  int K;               // Number of groups
+  int schedule;        // BP schedule, SBM_FLOOD or SBM_RESIDUAL
+  int precision;       // Storage of the messages, SBM_DOUBLE etc.
+  int nruns;           // Number of runs from different starting points
+  int prune;           // Set to abandon runs that are clearly losing
+  unsigned long seed;  // Seed for the first run; run i uses seed+i
+  int verbose;         // Set to print progress reports to stderr
+  char *scratch;       // Directory for out-of-core arrays, or NULL
+  int ordering;        // How to renumber the vertices, SBM_ORDER_NONE etc.
+  int nprocs;          // Number of processes to divide BP among
+  int orderedby;       // How the network has been renumbered
+  double *marginals;   // Marginals of the best run in the original order
+  MODEL *model;        // Parameters to use instead of fitting, or NULL
+
+  int *add;            // Pairs of vertices to join at the next update,
+  int nadd;            //   how many there are, and how many there is room
+  int addspace;        //   for
+  int *remove;         // Pairs of vertices to disconnect
+  int nremove;
+  int removespace;
+  int *relabel;        // Vertices to get new labels, and the labels
+  char **newlabel;
+  int nrelabel;
+  int relabelspace;
+  char **newvertex;    // Labels of new vertices
+  int nnew;
+  int newspace;
+
+  double logsmall;     // log(SMALL), as calculated by vlog()
+  int progress;        // Set to print progress of BP and EM to stderr
+  double bestL;        // Best log-likelihood of any finished run
+  int nfinished;       // Number of finished runs
+  long emsteps;        // Number of EM steps taken by all the runs
+  STATE *best;         // The best run
+
+  CHECKPOINT *checkpoint; // Where and how often to save checkpoints
+  uint64_t fingerprint;   // Of the network, to check checkpoints against
+
+  double tread;        // Seconds taken to read the network
+  double tmetadata;    // Seconds taken to make the metadata and blocks
+  double trun;         // Seconds taken by the last set of runs
+  double cread;        // CPU time for the same
+  double cmetadata;
+  double crun;
+};
+
+/* Allocate memory aligned to a cache line.  Used for the large arrays of
+ * messages and marginals, which are allocated once and reused on every EM
+ * step */
+
+#define ALIGNMENT 64
+
+void *aligned_malloc(size_t size)
+{
+  void *ptr;
+
+  if (posix_memalign(&ptr,ALIGNMENT,size)!=0) {
+    fprintf(stderr,"Out of memory\n");
+    exit(24);
+  }
+  return ptr;
+}
+
+
+/* Wall-clock time in seconds, for timing the parts of the calculation */
+
+double wall_time()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_MONOTONIC,&t);
+  return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+
+/* CPU time used by the whole process in seconds, including all threads */
+
+double cpu_time()
+{
+  struct timespec t;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&t);
+  return t.tv_sec + 1e-9*t.tv_nsec;
+}
+
+
+/* Kernels such as bp() and params() are written for a general number of
+ * groups k, but are also compiled separately for a few common small values
+ * of k, for which the compiler can unroll the loops over groups
+ * completely.  They are likewise compiled separately for each precision p
+ * in which the messages can be stored.  SPECIALIZE() generates the
+ * specialized versions of a kernel name_k() and a function name() that
+ * picks the right one for K and the precision */
+
+#define KERNEL static inline __attribute__((always_inline))
+
+#define SPECIALIZE_K(type,name,p,suffix)                       \
+  type name##_2##suffix(STATE *st) { return name##_k(2,p,st); }  \
+  type name##_3##suffix(STATE *st) { return name##_k(3,p,st); }  \
+  type name##_4##suffix(STATE *st) { return name##_k(4,p,st); }  \
+  type name##_8##suffix(STATE *st) { return name##_k(8,p,st); }  \
+  type name##_any##suffix(STATE *st) { return name##_k(st->K,p,st); }  \
+  type name##suffix(STATE *st)                                 \
+  {                                                            \
+    switch (st->K) {                                           \
+    case 2: return name##_2##suffix(st);                       \
+    case 3: return name##_3##suffix(st);                       \
+    case 4: return name##_4##suffix(st);                       \
+    case 8: return name##_8##suffix(st);                       \
+    default: return name##_any##suffix(st);                    \
+    }                                                          \
+  }
+
+#define SPECIALIZE(type,name)                                  \
+  SPECIALIZE_K(type,name,SBM_DOUBLE,_double)                   \
+  SPECIALIZE_K(type,name,SBM_FLOAT,_float)                     \
+  SPECIALIZE_K(type,name,SBM_BFLOAT16,_bfloat16)               \
+  type name(STATE *st)                                         \
+  {                                                            \
+    switch (st->precision) {                                   \
+    case SBM_FLOAT: return name##_float(st);                   \
+    case SBM_BFLOAT16: return name##_bfloat16(st);             \
+    default: return name##_double(st);                         \
+    }                                                          \
+  }
+
+
+/* Storage of the messages and terms.  The messages, K for every edge, are
+ * most of the memory, along with the terms, so they can be stored with
+ * less precision than doubles: as floats, or as bfloat16s, which are
+ * floats with only the top 16 bits kept.  Everything is calculated in
+ * double precision, and only rounded when it's stored.  Terms are logs,
+ * which need more bits than the messages, so they are stored as floats
+ * with bfloat16 messages.  With a constant p these compile down to plain
+ * loads and stores. */
+
+#define TERMS(p) ((p)==SBM_DOUBLE ? SBM_DOUBLE : SBM_FLOAT)
+
+int storage_size(int p)
+{
+  switch (p) {
+  case SBM_FLOAT: return sizeof(float);
+  case SBM_BFLOAT16: return sizeof(uint16_t);
+  default: return sizeof(double);
+  }
+}
+
+KERNEL double load_p(const int p, const void *a, long i)
+{
+  uint32_t bits;
+  float x;
+
+  switch (p) {
+  case SBM_FLOAT:
+    return ((const float*)a)[i];
+  case SBM_BFLOAT16:
+    bits = (uint32_t)((const uint16_t*)a)[i] << 16;
+    memcpy(&x,&bits,sizeof(float));
+    return x;
+  default:
+    return ((const double*)a)[i];
+  }
+}
+
+KERNEL void store_p(const int p, void *a, long i, double value)
+{
+  uint32_t bits;
+  float x;
+
+  switch (p) {
+  case SBM_FLOAT:
+    ((float*)a)[i] = value;
+    break;
+  case SBM_BFLOAT16:
+    x = value;
+    memcpy(&bits,&x,sizeof(float));
+    bits += 0x7fff + ((bits>>16)&1);     // Round to nearest, ties to even
+    ((uint16_t*)a)[i] = bits>>16;
+    break;
+  default:
+    ((double*)a)[i] = value;
+  }
+}
+
+/* The value that would be read back after storing x */
+
+KERNEL double round_p(const int p, double x)
+{
+  uint16_t h;
+
+  switch (p) {
+  case SBM_FLOAT:
+    return (float)x;
+  case SBM_BFLOAT16:
+    store_p(p,&h,0,x);
+    return load_p(p,&h,0);
+  default:
+    return x;
+  }
+}
+
+
+/* Decide whether the arrays of a run are to be shared among several
+ * processes, which is only done for a single run with the flooding
+ * schedule.  See em_processes(). */
+
+int shared(SBM *sbm)
+{
+  return (sbm->nprocs>1)&&(sbm->nruns==1)&&(sbm->schedule==SBM_FLOOD);
+}
+
+
+/* Allocate memory that is shared with child processes made after it */
+
+void *shared_memory(size_t size)
+{
+  void *ptr;
+
+  if (size==0) size = 1;
+  ptr = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+  if (ptr==MAP_FAILED) {
+    fprintf(stderr,"Out of memory\n");
+    exit(24);
+  }
+  return ptr;
+}
+
+
+/* Allocate and free the arrays of a state that the processes of a
+ * multi-process run write to, in shared memory if the state is shared */
+
+void *state_array(STATE *st, size_t size)
+{
+  return st->shared ? shared_memory(size) : aligned_malloc(size);
+}
+
+void free_state_array(STATE *st, void *ptr, size_t size)
+{
+  if (st->shared) munmap(ptr,size==0 ? 1 : size);
+  else free(ptr);
+}
+
+
+/* Out-of-core storage.  The arrays with K values for every edge, the
+ * messages and the terms, take most of the memory.  With a scratch
+ * directory set, they are put in files there and mapped into memory, so
+ * that when they don't fit in RAM the operating system pages them to and
+ * from the disk instead of the allocation failing.  The files are deleted
+ * as soon as they are made, so they vanish when the program ends, however
+ * it ends.  Space for them is reserved up front, so that a full disk is
+ * reported at the start rather than as a crash part way through. */
+
+void *edge_array(SBM *sbm, size_t size, int *mapped)
+{
+  int fd,status;
+  char *name;
+  void *ptr;
+
+  *mapped = 0;
+  if (sbm->scratch==NULL) {
+    if (!shared(sbm)) return aligned_malloc(size);
+    *mapped = 1;
+    return shared_memory(size);
+  }
+
+  name = malloc(strlen(sbm->scratch)+16);
+  sprintf(name,"%s/sbm-XXXXXX",sbm->scratch);
+  fd = mkstemp(name);
+  if (fd<0) {
+    fprintf(stderr,"Unable to make a file in scratch directory %s\n",
+	    sbm->scratch);
+    exit(24);
+  }
+  unlink(name);
+  free(name);
+  if (size==0) size = 1;
+  status = posix_fallocate(fd,0,size);
+  if (status!=0) {
+    fprintf(stderr,"Not enough space in scratch directory %s for %zu "
+	    "bytes\n",sbm->scratch,size);
+    exit(24);
+  }
+  ptr = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+  close(fd);
+  if (ptr==MAP_FAILED) {
+    fprintf(stderr,"Unable to map scratch file\n");
+    exit(24);
+  }
+  *mapped = 1;
+
+  return ptr;
+}
+
+void free_edge_array(void *ptr, size_t size, int mapped)
+{
+  if (!mapped) free(ptr);
+  else munmap(ptr,size==0 ? 1 : size);
+}
+
+
+/* Ask for the messages and terms of edges e0 to e1-1 to be read in from
+ * the disk ahead of time, while the threads work on the edges before
+ * them.  Each pass over the edges goes through them in order, a block at
+ * a time, so each block is prefetched as many blocks ahead as there are
+ * threads */
+
+void prefetch_range(void *base, size_t start, size_t end)
+{
+  size_t page=sysconf(_SC_PAGESIZE);
+
+  start -= start%page;
+  if (end>start) madvise((char*)base+start,end-start,MADV_WILLNEED);
+}
+
+void prefetch_edges(STATE *st, long e0, long e1)
+{
+  size_t esize=storage_size(st->precision);
+  size_t tsize=storage_size(TERMS(st->precision));
+
+  prefetch_range(st->eta,st->K*e0*esize,st->K*e1*esize);
+  prefetch_range(st->logterm,st->K*e0*tsize,st->K*e1*tsize);
+}
+
+int ahead()
+{
+#ifdef _OPENMP
+  return omp_get_num_threads();
+#else
+  return 1;
+#endif
+}
+
+void prefetch_eblock(STATE *st, int b)
+{
+  SBM *sbm=st->sbm;
+
+  if (!st->outofcore) return;
+  b += ahead();
+  if (b<sbm->neblocks) prefetch_edges(st,sbm->eblock[b],sbm->eblock[b+1]);
+}
+
+void prefetch_vblock(STATE *st, int b)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int u;
+
+  if (!st->outofcore) return;
+  b += ahead();
+  if (b>=sbm->nvblocks) return;
+  u = sbm->vblock[b+1];
+  prefetch_edges(st,G->vertex[sbm->vblock[b]].offset,
+		 u<G->nvertices ? G->vertex[u].offset : G->nedges);
+}
+
+
+/* Return 1 if the edges of the network are in a mapped snapshot */
+
+int edges_mapped(NETWORK *G)
+{
+  return (G->map!=NULL)&&((char*)G->edge>=G->map)
+    &&((char*)G->edge<G->map+G->maplength);
+}
+
+
+/* With a scratch directory, move a network whose edges are not in a mapped
+ * snapshot into a snapshot there, so that they too can be paged out.
+ * Returns zero on success */
+
+int spill_network(SBM *sbm)
+{
+  int fd,status;
+  char *name;
+
+  name = malloc(strlen(sbm->scratch)+16);
+  sprintf(name,"%s/sbm-XXXXXX",sbm->scratch);
+  fd = mkstemp(name);
+  if (fd<0) {
+    fprintf(stderr,"Unable to make a file in scratch directory %s\n",
+	    sbm->scratch);
+    free(name);
+    return 1;
+  }
+  close(fd);
+  status = write_snapshot(name,&sbm->G);
+  if (status==0) {
+    free_network(&sbm->G);
+    status = read_snapshot(name,&sbm->G);
+    if (status!=0) sbm->loaded = 0;
+  }
+  unlink(name);
+  free(name);
+
+  return status;
+}
+
+
+/* The current number of the vertex that was numbered i when the network
+ * was read.  Anything drawn at random for each vertex is drawn in this
+ * order, so that the results don't depend on the numbering. */
+
+int renumbered(SBM *sbm, int i)
+{
+  return (sbm->rank!=NULL) ? sbm->rank[i] : i;
+}
+
+
+/* Get metadata from the labels.  The readers have already put the
+ * distinct labels in a table, so we need only number them in the order
+ * they are first seen going through the vertices, which makes the numbering
+ * the same however the network was read. */
+
+void get_metadata(SBM *sbm)
+{
+  int u,v,i;
+  int *number;
+  NETWORK *G=&sbm->G;
+
+  /* Make space for the metadata numbers and labels */
+
+  sbm->x = malloc(G->nvertices*sizeof(int));
+  sbm->mlabel = malloc(G->nlabels*sizeof(char*));
+  number = malloc(G->nlabels*sizeof(int));
+  for (i=0; i<G->nlabels; i++) number[i] = -1;
+  sbm->nmlabels = 0;
+
+  /* Go through the vertices in their original order, numbering each label
+   * the first time we see it and recording it as the metadata type for the
+   * vertex */
+
+  for (v=0; v<G->nvertices; v++) {
+    u = renumbered(sbm,v);
+    i = G->vertex[u].label;
+    if (number[i]<0) {
+      number[i] = sbm->nmlabels;
+      sbm->mlabel[sbm->nmlabels++] = G->label[i];  // Just set pointers equal
+    }
+    sbm->x[u] = number[i];
+  }
+
+  free(number);
+}
+
+
+/* Make lists of the vertices with each metadata value */
+
+void group_metadata(SBM *sbm)
+{
+  int u,i;
+  int n=sbm->G.nvertices;
+  int *x=sbm->x,*nx,*xstart,*xvertex;
+
+  /* Count how many nodes there are in each metadata group, and make lists
+   * of them */
+
+  nx = calloc(sbm->nmlabels,sizeof(int));
+  for (u=0; u<n; u++) nx[x[u]]++;
+
+  xstart = malloc((sbm->nmlabels+1)*sizeof(int));
+  xvertex = malloc(n*sizeof(int));
+  for (i=xstart[0]=0; i<sbm->nmlabels; i++) xstart[i+1] = xstart[i] + nx[i];
+  for (u=n-1; u>=0; u--) xvertex[--xstart[x[u]+1]] = u;
+  for (i=0; i<sbm->nmlabels; i++) xstart[i+1] = xstart[i] + nx[i];
+
+  sbm->nx = nx;
+  sbm->xstart = xstart;
+  sbm->xvertex = xvertex;
+
+  if (sbm->verbose) {
+    fprintf(stderr,"Found %i distinct metadata values:\n",sbm->nmlabels);
+    for (i=0; (i<sbm->nmlabels)&&(i<MAXPRINT); i++) {
+      fprintf(stderr," %i %s\n",i,sbm->mlabel[i]);
+    }
+    if (sbm->nmlabels>MAXPRINT) fprintf(stderr," ...\n");
+  }
+}
+
+
+/* Divide the vertices and edges into blocks for the threads to work on.
+ * Vertex blocks contain roughly equal numbers of vertices plus edges, so
+ * that a block containing a hub has fewer vertices.  Edge blocks contain
+ * equal numbers of edges regardless of which vertices they belong to, so
+ * the edges of a hub get divided among several blocks.  The blocks depend
+ * only on the network, not on the number of threads, and the reductions
+ * over them are always done in block order, so the results are the same
+ * whatever the number of threads */
+
+void make_blocks(SBM *sbm)
+{
+  int u,b;
+  int nvblocks,neblocks;
+  int *vblock;
+  long work;
+  NETWORK *G=&sbm->G;
+
+  // Vertex blocks
+
+  vblock = malloc((G->nvertices+1)*sizeof(int));
+  nvblocks = 0;
+  work = 0;
+  for (u=0; u<G->nvertices; u++) {
+    if (work==0) vblock[nvblocks++] = u;
+    work += G->vertex[u].degree + 1;
+    if (work>=BLOCKSIZE) work = 0;
+  }
+  vblock[nvblocks] = G->nvertices;
+  sbm->vblock = realloc(vblock,(nvblocks+1)*sizeof(int));
+  sbm->nvblocks = nvblocks;
+
+  // Edge blocks
+
+  neblocks = (G->nedges+BLOCKSIZE-1)/BLOCKSIZE;
+  sbm->eblock = malloc((neblocks+1)*sizeof(long));
+  sbm->eblockvertex = malloc((neblocks+1)*sizeof(int));
+  for (b=u=0; b<neblocks; b++) {
+    sbm->eblock[b] = (long)b*BLOCKSIZE;
+    while (sbm->eblock[b]>=G->vertex[u].offset+G->vertex[u].degree) u++;
+    sbm->eblockvertex[b] = u;
+  }
+  sbm->eblock[neblocks] = G->nedges;
+  sbm->neblocks = neblocks;
+}
+
+
+/* Make a list of the vertex each edge belongs to */
+
+void make_sources(SBM *sbm)
+{
+  int u,i;
+  NETWORK *G=&sbm->G;
+
+  sbm->esource = malloc(G->nedges*sizeof(int));
+  for (u=0; u<G->nvertices; u++) {
+    for (i=0; i<G->vertex[u].degree; i++) {
+      sbm->esource[G->vertex[u].offset+i] = u;
+    }
+  }
+}
+
+
+/* Add up the per-block partial results for n quantities stored one block
+ * after another in partial[], in block order */
+
+void reduce(int nblocks, int n, double *partial, double *result)
+{
+  int b,i;
+
+  for (i=0; i<n; i++) result[i] = 0.0;
+  for (b=0; b<nblocks; b++) {
+    for (i=0; i<n; i++) result[i] += partial[n*b+i];
+  }
+}
+
+
+/* Divide the work among nprocs processes, giving process rank an equal
+ * share of the vertex blocks, which have roughly equal work, and the edge
+ * blocks that start among the same vertices.  Each process thus works on
+ * one range of vertices and their edges, and reads the messages of other
+ * processes only on the edges that cross between ranges. */
+
+void partition(STATE *st, int rank, int nprocs)
+{
+  SBM *sbm=st->sbm;
+  int u0,u1;
+
+  st->rank = rank;
+  st->nprocs = nprocs;
+  st->vb0 = (long)sbm->nvblocks*rank/nprocs;
+  st->vb1 = (long)sbm->nvblocks*(rank+1)/nprocs;
+  u0 = sbm->vblock[st->vb0];
+  u1 = sbm->vblock[st->vb1];
+  for (st->eb0=0; (st->eb0<sbm->neblocks)
+	 &&(sbm->eblockvertex[st->eb0]<u0); st->eb0++);
+  for (st->eb1=st->eb0; (st->eb1<sbm->neblocks)
+	 &&(sbm->eblockvertex[st->eb1]<u1); st->eb1++);
+  st->x0 = (long)sbm->nmlabels*rank/nprocs;
+  st->x1 = (long)sbm->nmlabels*(rank+1)/nprocs;
+}
+
+
+/* Wait until all the processes of a multi-process run get here.  If one
+ * of them dies instead, the others would wait for ever, so process zero
+ * checks for dead children and the children check for a dead parent. */
+
+void barrier(STATE *st)
+{
+  int gen,status;
+  SYNC *sync=st->sync;
+
+  if (st->nprocs==1) return;
+  gen = __atomic_load_n(&sync->generation,__ATOMIC_ACQUIRE);
+  if (__atomic_add_fetch(&sync->count,1,__ATOMIC_ACQ_REL)==st->nprocs) {
+    __atomic_store_n(&sync->count,0,__ATOMIC_RELAXED);
+    __atomic_store_n(&sync->generation,gen+1,__ATOMIC_RELEASE);
+    return;
+  }
+  while (__atomic_load_n(&sync->generation,__ATOMIC_ACQUIRE)==gen) {
+    if (st->rank>0) {
+      if (getppid()!=st->parent) _exit(1);
+    } else if (waitpid(-1,&status,WNOHANG)>0) {
+      fprintf(stderr,"Worker process failed\n");
+      exit(25);
+    }
+    sched_yield();
+  }
+}
+
+
+/* Function to generate d numbers at random that add up to unity */
+
+void random_unity(gsl_rng *rng, int d, double *x)
+{
+  int k;
+  double sum=0.0;
+
+  for (k=0; k<d; k++) {
+    x[k] = gsl_rng_uniform(rng);
+    sum += x[k];
+  }
+  for (k=0; k<d; k++) x[k] /= sum;
+}
+
+
+/* Belief propagation
+ *
+ * The message from v to u is v's full log-field less the contribution of
+ * the edges between v and u, so rather than summing over the neighbors of
+ * v separately for each message we calculate the field of each vertex once
+ * and take the appropriate term out of it, using the reverse-edge index
+ * built by read_network().  Terms that fall below SMALL are clamped as
+ * before, but they are counted separately rather than added into the
+ * field, so that removing them again is exact.
+ *
+ * The fields and terms live in the arrays field, nsmall and logterm, which
+ * are laid out like q and eta.  The kernels below calculate them, and the
+ * messages from them, and are shared by the two BP schedules that follow */
+
+/* Calculate the log-prefactors from the expected group degrees */
+
+KERNEL void logprefactors_k(const int k, STATE *st, double *d,
+			    double *logpre)
+{
+  int r,s;
+
+  for (r=0; r<k; r++) {
+    logpre[r] = 0.0;
+    for (s=0; s<k; s++) logpre[r] -= st->omega[k*r+s]*d[s];
+  }
+}
+
+
+/* Calculate the expected group degrees d[] and from them the
+ * log-prefactors (without the leading factor of d_i or the prior) */
+
+KERNEL void prefactors_k(const int k, STATE *st, double *d, double *logpre)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int b,r;
+
+  barrier(st);
+#pragma omp parallel for private(r) schedule(dynamic) if (st->nprocs==1)
+  for (b=st->vb0; b<st->vb1; b++) {
+    int u;
+    double *dpart=st->partial+k*b;
+    for (r=0; r<k; r++) dpart[r] = 0.0;
+    for (u=sbm->vblock[b]; u<sbm->vblock[b+1]; u++) {
+      for (r=0; r<k; r++) dpart[r] += st->q[k*u+r]*G->vertex[u].multidegree;
+    }
+  }
+  barrier(st);
+  reduce(sbm->nvblocks,k,st->partial,d);
+  logprefactors_k(k,st,d,logpre);
+}
+
+
+/* Calculate the contributions of the messages on the n edges starting at
+ * e to the fields of the vertices they are sent to.  The sums are all
+ * calculated first and then their logs in one go.  Sums that fall below
+ * SMALL are clamped to SMALL, so that their logs come out exactly equal to
+ * logsmall.  Terms stored as doubles are calculated in place; otherwise
+ * they go through a buffer, in batches of nbatch edges. */
+
+KERNEL void terms_k(const int k, const int p, STATE *st, long e, long n)
+{
+  int r,s;
+  long f,g,i,nb,nbatch;
+  double sum;
+  double *out;
+  double etaf[k];
+  double buffer[TERMS(p)==SBM_DOUBLE ? 1 : VBUF];
+
+  nbatch = (TERMS(p)==SBM_DOUBLE) ? n : VBUF/k;
+  if (nbatch<1) nbatch = 1;
+  for (g=e; g<e+n; g+=nb) {
+    nb = e + n - g;
+    if (nb>nbatch) nb = nbatch;
+    if (TERMS(p)==SBM_DOUBLE) out = (double*)st->logterm + k*g;
+    else out = buffer;
+    for (f=g; f<g+nb; f++) {
+      for (s=0; s<k; s++) etaf[s] = load_p(p,st->eta,k*f+s);
+      for (r=0; r<k; r++) {
+	sum = 0.0;
+	for (s=0; s<k; s++) sum += etaf[s]*st->omega[k*r+s];
+	if (sum<SMALL) sum = SMALL;    // Prevent -Inf
+	out[k*(f-g)+r] = sum;
+      }
+    }
+    vlog(k*nb,out,out);
+    if (TERMS(p)!=SBM_DOUBLE) {
+      for (i=0; i<k*nb; i++) store_p(TERMS(p),st->logterm,k*g+i,out[i]);
+    }
+  }
+}
+
+
+/* Calculate the one-vertex marginal of vertex u from its field */
+
+KERNEL void marginal_k(const int k, STATE *st, int u, double *logpre,
+		       double logsmall)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int r;
+  double norm,largest;
+  double qun[k];
+
+  for (r=0; r<k; r++) {
+    qun[r] = st->field[k*u+r] + G->vertex[u].multidegree*logpre[r]
+      + st->nsmall[k*u+r]*logsmall;
+    if (r==0) largest = qun[r];
+    else if (qun[r]>largest) largest = qun[r];
+  }
+
+  /* Normalize */
+
+  for (r=0; r<k; r++) qun[r] -= largest;
+  vexp(k,qun,qun);
+  norm = 0.0;
+  for (r=0; r<k; r++) norm += qun[r];
+  for (r=0; r<k; r++) st->q[k*u+r] = qun[r]/norm;
+}
+
+
+/* Add up the field of vertex u from its terms and calculate its new
+ * one-vertex marginal.  The field includes the prior but not the
+ * prefactor, which is added when the field is used.  Each term counts as
+ * many times as the multiplicity of its edge. */
+
+KERNEL void field_k(const int k, const int p, STATE *st, int u,
+		    double *logpre, double logsmall)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int i,r,m;
+  long termu;
+  double term;
+  EDGE *edge=G->vertex[u].edge;
+
+  termu = k*G->vertex[u].offset;
+  for (r=0; r<k; r++) {
+    st->field[k*u+r] = st->loggmma[k*sbm->x[u]+r];
+    st->nsmall[k*u+r] = 0;
+    for (i=0; i<G->vertex[u].degree; i++) {
+      m = edge[i].multiplicity;
+      term = load_p(TERMS(p),st->logterm,termu+k*i+r);
+      if (term==logsmall) st->nsmall[k*u+r] += m;
+      else st->field[k*u+r] += m*term;
+    }
+  }
+  marginal_k(k,st,u,logpre,logsmall);
+}
+
+
+/* Calculate the logs of the gammas, which are used in every field */
+
+KERNEL void loggammas_k(const int k, STATE *st)
+{
+  SBM *sbm=st->sbm;
+  int i,r;
+
+  for (i=0; i<sbm->nmlabels; i++) {
+    for (r=0; r<k; r++) st->loggmma[k*i+r] = st->gmma[r][i];
+  }
+  vlog(k*sbm->nmlabels,st->loggmma,st->loggmma);
+}
+
+
+/* Calculate the terms for all edges, then the fields and marginals for
+ * all vertices */
+
+KERNEL void fields_k(const int k, const int p, STATE *st, double *logpre,
+		     double logsmall)
+{
+  SBM *sbm=st->sbm;
+  int b;
+
+#pragma omp parallel for schedule(dynamic) if (st->nprocs==1)
+  for (b=st->eb0; b<st->eb1; b++) {
+    prefetch_eblock(st,b);
+    terms_k(k,p,st,sbm->eblock[b],sbm->eblock[b+1]-sbm->eblock[b]);
+  }
+  barrier(st);
+
+#pragma omp parallel for schedule(dynamic) if (st->nprocs==1)
+  for (b=st->vb0; b<st->vb1; b++) {
+    int u;
+    prefetch_vblock(st,b);
+    for (u=sbm->vblock[b]; u<sbm->vblock[b+1]; u++) {
+      field_k(k,p,st,u,logpre,logsmall);
+    }
+  }
+  barrier(st);
+}
+
+
+/* Calculate the log of the new value of the message on edge e from the
+ * current fields, unnormalized, into logeta[].  Its largest element is
+ * subtracted off, so that it can be exponentiated without overflow. */
+
+KERNEL void logmessage_k(const int k, const int p, STATE *st, long e,
+			 double *logpre, double logsmall, double *logeta)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int r,v,j,c;
+  long termv;
+  double largest,term;
+
+  v = G->edge[e].target;
+  j = G->edge[e].twin;
+  c = G->edge[e].parallel;
+  termv = k*(G->vertex[v].offset+j);
+  for (r=0; r<k; r++) {
+    logeta[r] = st->field[k*v+r] + G->vertex[v].multidegree*logpre[r]
+      + st->nsmall[k*v+r]*logsmall;
+    if (j<0) continue;           // No edge back from v
+    term = load_p(TERMS(p),st->logterm,termv+r);
+    if (term==logsmall) logeta[r] -= c*logsmall;
+    else logeta[r] -= c*term;
+  }
+
+  largest = logeta[0];
+  for (r=1; r<k; r++) {
+    if (logeta[r]>largest) largest = logeta[r];
+  }
+  for (r=0; r<k; r++) logeta[r] -= largest;
+}
+
+
+/* Normalize the exponentiated message etaun[] for edge e, putting the
+ * result in neweta[], and return the largest change in any element from
+ * the current message.  neweta can be the same as etaun.  The result is
+ * rounded to the precision the messages are stored in, so that the change
+ * is the change in the stored message. */
+
+KERNEL double normalize_k(const int k, const int p, STATE *st, long e,
+			  double *etaun, double *neweta)
+{
+  int r;
+  double norm,value,delta,maxdelta;
+
+  norm = 0.0;
+  for (r=0; r<k; r++) norm += etaun[r];
+  maxdelta = 0.0;
+  for (r=0; r<k; r++) {
+    value = round_p(p,etaun[r]/norm);
+    delta = fabs(value-load_p(p,st->eta,k*e+r));
+
+    // A bfloat16 has only 8 significant bits, so a message can flip back
+    // and forth between two neighboring values for ever, and changes of
+    // one unit in the last place count as none
+
+    if ((p==SBM_BFLOAT16)&&(delta<=0x1p-7*value)) delta = 0.0;
+    if (delta>maxdelta) maxdelta = delta;
+    neweta[r] = value;
+  }
+
+  return maxdelta;
+}
+
+
+/* Calculate the new, normalized value of the message on edge e from the
+ * current fields, and return the largest change in any of its elements.
+ * The message is stored in neweta[] but not copied into eta. */
+
+KERNEL double message_k(const int k, const int p, STATE *st, long e,
+			double *logpre, double logsmall, double *neweta)
+{
+  double etaun[k];
+
+  logmessage_k(k,p,st,e,logpre,logsmall,etaun);
+  vexp(k,etaun,etaun);
+  return normalize_k(k,p,st,e,etaun,neweta);
+}
+
+
+/* Store the message neweta[] on edge e */
+
+KERNEL void store_message_k(const int k, const int p, STATE *st, long e,
+			    double *neweta)
+{
+  int r;
+
+  for (r=0; r<k; r++) store_p(p,st->eta,k*e+r,neweta[r]);
+}
+
+
+/* Record a BP sweep that started at wall-clock time start, and the
+ * largest change it made in any message */
+
+void record_sweep(STATE *st, double start, double maxdelta)
+{
+  if (st->nsweep==st->sweepspace) {
+    st->sweepspace = 2*st->sweepspace + 64;
+    st->sweep = realloc(st->sweep,st->sweepspace*sizeof(SWEEP));
+  }
+  st->sweep[st->nsweep].wall = wall_time() - start;
+  st->sweep[st->nsweep].maxdelta = maxdelta;
+  st->nsweep++;
+}
+
+
+/* Do BP with the synchronous ("flooding") schedule, in which every message
+ * is recalculated on every sweep.  Each sweep is done in three passes: the
+ * log-terms, which are independent for every edge; the fields and
+ * marginals, which are independent for every vertex; and the new messages,
+ * which are again independent for every edge.  Each pass is divided among
+ * the threads by blocks. */
+
+KERNEL int bp_flood_k(const int k, const int p, STATE *st)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  double logsmall=round_p(TERMS(p),sbm->logsmall);
+  int b;
+  int steps;
+  int nbatch;
+  double maxdelta;
+  double start;
+  double d[k];
+  double logpre[k];
+
+  // Messages are calculated in batches of nbatch, so that all their
+  // exponentials can be taken in one go
+
+  nbatch = VBUF/k;
+  if (nbatch<1) nbatch = 1;
+  loggammas_k(k,st);
+
+  // Main BP loop
+
+  steps = 0;
+  do {
+
+    /* Calculate the fields and new values for the one-vertex marginals */
+
+    start = wall_time();
+    prefactors_k(k,st,d,logpre);
+    fields_k(k,p,st,logpre,logsmall);
+
+    /* Calculate new values for the messages and find the largest change.
+     * The terms have all been calculated from the old messages already, so
+     * the messages can be overwritten in place. */
+
+#pragma omp parallel for schedule(dynamic) if (st->nprocs==1)
+    for (b=st->eb0; b<st->eb1; b++) {
+      long e,f,n;
+      double delta;
+      double etaun[k*nbatch];
+      prefetch_eblock(st,b);
+      st->partial[b] = 0.0;
+      for (e=sbm->eblock[b]; e<sbm->eblock[b+1]; e+=n) {
+	n = sbm->eblock[b+1] - e;
+	if (n>nbatch) n = nbatch;
+	for (f=e; f<e+n; f++) {
+	  logmessage_k(k,p,st,f,logpre,logsmall,etaun+k*(f-e));
+	}
+	vexp(k*n,etaun,etaun);
+	for (f=e; f<e+n; f++) {
+	  delta = normalize_k(k,p,st,f,etaun+k*(f-e),etaun+k*(f-e));
+	  store_message_k(k,p,st,f,etaun+k*(f-e));
+	  if (delta>st->partial[b]) st->partial[b] = delta;
+	}
+      }
+    }
+    barrier(st);
+    for (b=0,maxdelta=0.0; b<sbm->neblocks; b++) {
+      if (st->partial[b]>maxdelta) maxdelta = st->partial[b];
+    }
+    st->updates += G->nedges;
+    st->sweeps++;
+    record_sweep(st,start,maxdelta);
+
+  } while ((maxdelta>BP_ACC)&&(++steps<=BP_MAXSTEP));
+
+  return steps;
+}
+
+SPECIALIZE(int,bp_flood)
+
+
+/* Functions for the max-heap of edges keyed by residual used by the
+ * residual schedule.  heap[] holds the edges and heappos[] the position of
+ * each edge in the heap. */
+
+void heap_swap(STATE *st, long h1, long h2)
+{
+  long e1,e2;
+
+  e1 = st->heap[h1];
+  e2 = st->heap[h2];
+  st->heap[h1] = e2;
+  st->heap[h2] = e1;
+  st->heappos[e2] = h1;
+  st->heappos[e1] = h2;
+}
+
+void heap_up(STATE *st, long h)
+{
+  long parent;
+
+  while (h>0) {
+    parent = (h-1)/2;
+    if (st->residual[st->heap[parent]]>=st->residual[st->heap[h]]) break;
+    heap_swap(st,h,parent);
+    h = parent;
+  }
+}
+
+void heap_down(STATE *st, long h)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  long child;
+
+  while ((child=2*h+1)<G->nedges) {
+    if ((child+1<G->nedges)&&
+	(st->residual[st->heap[child+1]]>st->residual[st->heap[child]])) {
+      child++;
+    }
+    if (st->residual[st->heap[h]]>=st->residual[st->heap[child]]) break;
+    heap_swap(st,h,child);
+    h = child;
+  }
+}
+
+void heap_update(STATE *st, long e, double residual)
+{
+  double old;
+
+  old = st->residual[e];
+  st->residual[e] = residual;
+  if (residual>old) heap_up(st,st->heappos[e]);
+  else heap_down(st,st->heappos[e]);
+}
+
+
+/* Do BP with the residual schedule.  Rather than recalculating every
+ * message on every sweep, we keep each message's residual, the amount by
+ * which it would change if recalculated now, in a heap, and always update
+ * the message with the largest residual, then the residuals of the
+ * messages that depend on it.  Updating a message changes the field of
+ * only one vertex, u say, so only the messages from u need new residuals.
+ *
+ * The prefactors depend on the expected group degrees, which involve all
+ * the marginals.  These are kept up to date as the marginals change, but
+ * the small changes they make to all the other residuals are not.  So the
+ * updates are done in rounds of at most one update per edge on average,
+ * after which all the fields and residuals are recalculated.  BP finishes
+ * when no residual exceeds BP_ACC at the start of a round.  This schedule
+ * runs on a single thread. */
+
+KERNEL int bp_residual_k(const int k, const int p, STATE *st)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  double logsmall=round_p(TERMS(p),sbm->logsmall);
+  int i,r,m;
+  int u,w;
+  int steps;
+  long e,f,h,pops;
+  double maxdelta;
+  double start;
+  double old,term;
+  double d[k];
+  double logpre[k];
+  double oldq[k];
+  double neweta[k];
+
+  loggammas_k(k,st);
+
+  steps = 0;
+  do {
+
+    // Recalculate all the fields and residuals and build the heap
+
+    start = wall_time();
+    prefactors_k(k,st,d,logpre);
+    fields_k(k,p,st,logpre,logsmall);
+    for (e=0; e<G->nedges; e++) {
+      st->residual[e] = message_k(k,p,st,e,logpre,logsmall,neweta);
+      st->heap[e] = e;
+      st->heappos[e] = e;
+    }
+    for (h=G->nedges/2-1; h>=0; h--) heap_down(st,h);
+    maxdelta = (G->nedges>0) ? st->residual[st->heap[0]] : 0.0;
+    if (maxdelta<=BP_ACC) {
+      record_sweep(st,start,maxdelta);
+      break;
+    }
+
+    // Update messages in order of residual
+
+    for (pops=0; pops<G->nedges; pops++) {
+      e = st->heap[0];
+      if (st->residual[e]<=BP_ACC) break;
+
+      // Update the message on edge e
+
+      message_k(k,p,st,e,logpre,logsmall,neweta);
+      store_message_k(k,p,st,e,neweta);
+      heap_update(st,e,0.0);
+
+      // Update its term in the field of the vertex u it is sent to
+
+      u = sbm->esource[e];
+      m = G->edge[e].multiplicity;
+      for (r=0; r<k; r++) {
+	old = load_p(TERMS(p),st->logterm,k*e+r);
+	if (old==logsmall) st->nsmall[k*u+r] -= m;
+	else st->field[k*u+r] -= m*old;
+      }
+      terms_k(k,p,st,e,1);
+      for (r=0; r<k; r++) {
+	term = load_p(TERMS(p),st->logterm,k*e+r);
+	if (term==logsmall) st->nsmall[k*u+r] += m;
+	else st->field[k*u+r] += m*term;
+      }
+
+      // Update u's marginal, and with it the expected group degrees and
+      // the prefactors
+
+      for (r=0; r<k; r++) oldq[r] = st->q[k*u+r];
+      marginal_k(k,st,u,logpre,logsmall);
+      for (r=0; r<k; r++) {
+	d[r] += (st->q[k*u+r]-oldq[r])*G->vertex[u].multidegree;
+      }
+      logprefactors_k(k,st,d,logpre);
+
+      // Update the residuals of the messages from u
+
+      for (i=0; i<G->vertex[u].degree; i++) {
+	w = G->vertex[u].edge[i].target;
+	if (G->vertex[u].edge[i].twin<0) continue;
+	f = G->vertex[w].offset + G->vertex[u].edge[i].twin;
+	heap_update(st,f,message_k(k,p,st,f,logpre,logsmall,neweta));
+      }
+    }
+    st->updates += pops;
+    st->sweeps++;
+    record_sweep(st,start,maxdelta);
+
+  } while (++steps<=BP_MAXSTEP);
+
+  // If BP didn't converge, bring the marginals up to date with the final
+  // messages
+
+  if (maxdelta>BP_ACC) fields_k(k,p,st,logpre,logsmall);
+
+  return steps;
+}
+
+SPECIALIZE(int,bp_residual)
+
+
+/* Do BP with whichever schedule was chosen */
+
+int bp(STATE *st)
+{
+  SBM *sbm=st->sbm;
+  if (sbm->schedule==SBM_RESIDUAL) return bp_residual(st);
+  else return bp_flood(st);
+}
+
+
+// Function to calculate new values of the parameters
+
+KERNEL double params_k(const int k, const int p, STATE *st)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int b;
+  int i;
+  int r,s;
+  int nbatch;
+  double d[k+1];         // Last element holds the vertex entropy sum
+  double sum[k*k+1];     // Last element holds the edge entropy sum
+  double L;
+
+  // Calculate some basics.  The sums over vertices are done by blocks, but
+  // nrx is summed separately for each metadata value over the list of
+  // vertices with that value.
+
+  barrier(st);
+#pragma omp parallel for private(r) schedule(dynamic) if (st->nprocs==1)
+  for (b=st->vb0; b<st->vb1; b++) {
+    int u;
+    double logq[k];
+    double *dpart=st->partial+(k+1)*b;
+    for (r=0; r<=k; r++) dpart[r] = 0.0;
+    for (u=sbm->vblock[b]; u<sbm->vblock[b+1]; u++) {
+      for (r=0; r<k; r++) dpart[r] += st->q[k*u+r]*G->vertex[u].multidegree;
+      if (G->vertex[u].multidegree==0) continue;
+      vlog(k,st->q+k*u,logq);
+      for (r=0; r<k; r++) {
+	if (st->q[k*u+r]>0.0) {
+	  dpart[k] += (G->vertex[u].multidegree-1)*st->q[k*u+r]*logq[r];
+	}
+      }
+    }
+  }
+#pragma omp parallel for private(r) schedule(dynamic) if (st->nprocs==1)
+  for (i=st->x0; i<st->x1; i++) {
+    int u;
+    for (r=0; r<k; r++) st->nrx[r][i] = 0.0;
+    for (u=sbm->xstart[i]; u<sbm->xstart[i+1]; u++) {
+      for (r=0; r<k; r++) st->nrx[r][i] += st->q[k*sbm->xvertex[u]+r];
+    }
+  }
+
+  barrier(st);
+  reduce(sbm->nvblocks,k+1,st->partial,d);
+
+  // Calculate new values of the gammas, unless they are fixed
+
+  if (!st->fixed) {
+    for (r=0; r<k; r++) {
+      for (i=0; i<sbm->nmlabels; i++) {
+	st->gmma[r][i] = st->nrx[r][i]/sbm->nx[i];
+      }
+    }
+  }
+
+  // Calculate the new values of the omegas.  Each block of edges adds up
+  // its own sums, in the k*k+1 values of partial[] following the block's
+  // position, with the last being the sum that contributes to the entropy.
+  // The edges are taken in batches of nbatch, and the logs needed for the
+  // entropy are calculated together at the end of each batch.
+
+  nbatch = VBUF/(k*k);
+  if (nbatch<1) nbatch = 1;
+
+  barrier(st);
+#pragma omp parallel for private(r,s) schedule(dynamic) if (st->nprocs==1)
+  for (b=st->eb0; b<st->eb1; b++) {
+    int u,v,j,m;
+    long e,f,n;
+    double norm;
+    double term[k][k];
+    double etaui[k],etavj[k];
+    double quvrs[k*k*nbatch];
+    double logquvrs[k*k*nbatch];
+    double *spart=st->partial+(k*k+1)*b;
+
+    prefetch_eblock(st,b);
+    for (r=0; r<=k*k; r++) spart[r] = 0.0;
+
+    u = sbm->eblockvertex[b];
+    for (f=sbm->eblock[b]; f<sbm->eblock[b+1]; f+=n) {
+      n = sbm->eblock[b+1] - f;
+      if (n>nbatch) n = nbatch;
+      for (e=f; e<f+n; e++) {
+	while (e>=G->vertex[u].offset+G->vertex[u].degree) u++;
+	v = G->edge[e].target;
+
+	// Look up the edge that leads back from v to u
+
+	j = G->edge[e].twin;
+	if (j<0) {
+	  fprintf(stderr,"Error!\n");
+	  exit(23);
+	}
+	for (r=0; r<k; r++) {
+	  etaui[r] = load_p(p,st->eta,k*e+r);
+	  etavj[r] = load_p(p,st->eta,k*(G->vertex[v].offset+j)+r);
+	}
+
+	// Calculate the terms and the normalization factor
+
+	norm = 0.0;
+	for (r=0; r<k; r++) {
+	  for (s=0; s<k; s++) {
+	    term[r][s] = st->omega[k*r+s]*etaui[r]*etavj[s];
+	    norm += term[r][s];
+	  }
+	}
+
+	// Add to the running sums, counting the edge as many times as its
+	// multiplicity
+
+	m = G->edge[e].multiplicity;
+	for (r=0; r<k; r++) {
+	  for (s=0; s<k; s++) {
+	    quvrs[k*k*(e-f)+k*r+s] = term[r][s]/norm;
+	    spart[k*r+s] += m*quvrs[k*k*(e-f)+k*r+s];
+	  }
+	}
+      }
+
+      // Add the batch to the entropy sum
+
+      vlog(k*k*n,quvrs,logquvrs);
+      for (e=0; e<k*k*n; e++) {
+	m = G->edge[f+e/(k*k)].multiplicity;
+	if (quvrs[e]!=0.0) spart[k*k] += m*quvrs[e]*logquvrs[e];
+      }
+    }
+  }
+  barrier(st);
+  reduce(sbm->neblocks,k*k+1,st->partial,sum);
+
+  // Calculate the new values of the omega variables (after calculating
+  // the likelihood using the old omegas), unless they are fixed
+
+  if (!st->fixed) {
+    for (r=0; r<k; r++) {
+      for (s=0; s<k; s++) st->omega[k*r+s] = sum[k*r+s]/(d[r]*d[s]);
+    }
+  }
+
+  // Calculate the expected log-likelihood
+
+  // Internal energy first.  With fixed parameters, which don't maximize
+  // it, there are extra terms that otherwise add up to zero.
+
+  L = 0.0;
+  for (r=0; r<k; r++) {
+    for (s=0; s<k; s++) {
+      if (sum[k*r+s]!=0.0) L += 0.5*sum[k*r+s]*log(st->omega[k*r+s]);
+      if (st->fixed) L += 0.5*(sum[k*r+s]-d[r]*d[s]*st->omega[k*r+s]);
+    }
+    for (i=0; i<sbm->nmlabels; i++) {
+      if (st->gmma[r][i]<=0.0) continue;
+      if (st->fixed) L += st->nrx[r][i]*log(st->gmma[r][i]);
+      else L += sbm->nx[i]*st->gmma[r][i]*log(st->gmma[r][i]);
+    }
+  }
+
+  // Now the entropy
+
+  L -= 0.5*sum[k*k];
+  L += d[k];
+
+  return L;
+}
+
+SPECIALIZE(double,params)
+
+
+/* Make space for a state for a run of the EM algorithm with K groups, with
+ * its own random number generator started from the given seed */
+
+STATE *alloc_state(SBM *sbm, unsigned long seed)
+{
+  int K=sbm->K;
+  int r,n;
+  STATE *st;
+  NETWORK *G=&sbm->G;
+
+  st = malloc(sizeof(STATE));
+  st->sbm = sbm;
+  st->K = K;
+  st->nvertices = G->nvertices;
+  st->nmlabels = sbm->nmlabels;
+  st->precision = sbm->precision;
+  st->rng = gsl_rng_alloc(gsl_rng_mt19937);
+  gsl_rng_set(st->rng,seed);
+  st->seed = seed;
+
+  // Marginals and messages
+
+  st->shared = shared(sbm);
+  st->q = state_array(st,K*G->nvertices*sizeof(double));
+  st->etasize = K*G->nedges*storage_size(st->precision);
+  st->eta = edge_array(sbm,st->etasize,&st->mapped);
+  st->outofcore = (sbm->scratch!=NULL);
+
+  // Working arrays used by bp() and params()
+
+  st->field = state_array(st,K*G->nvertices*sizeof(double));
+  st->nsmall = state_array(st,K*G->nvertices*sizeof(int));
+  st->termsize = K*G->nedges*storage_size(TERMS(st->precision));
+  st->logterm = edge_array(sbm,st->termsize,&st->mapped);
+  n = (sbm->nvblocks>sbm->neblocks) ? sbm->nvblocks : sbm->neblocks;
+  st->partialsize = n*(K*K+1)*sizeof(double);
+  st->partial = state_array(st,st->partialsize);
+  if (sbm->schedule==SBM_RESIDUAL) {
+    st->residual = malloc(G->nedges*sizeof(double));
+    st->heap = malloc(G->nedges*sizeof(long));
+    st->heappos = malloc(G->nedges*sizeof(long));
+  } else {
+    st->residual = NULL;
+    st->heap = st->heappos = NULL;
+  }
+  st->updates = st->sweeps = 0;
+
+  st->loggmma = malloc(K*sbm->nmlabels*sizeof(double));
+  st->nrx = malloc(K*sizeof(double*));
+  for (r=0; r<K; r++) {
+    st->nrx[r] = state_array(st,sbm->nmlabels*sizeof(double));
+  }
+
+  // Parameters
+
+  st->gmma = malloc(K*sizeof(double*));
+  for (r=0; r<K; r++) st->gmma[r] = malloc(sbm->nmlabels*sizeof(double));
+  st->omega = malloc(K*K*sizeof(double));
+
+  st->emsteps = st->bpsteps = 0;
+  st->tbp = st->tparams = 0.0;
+  st->sweep = NULL;
+  st->nsweep = st->sweepspace = 0;
+  st->step = NULL;
+  st->nstep = st->stepspace = 0;
+  st->L = -HUGE_VAL;
+  for (r=0; r<3; r++) st->Lhist[r] = -HUGE_VAL;
+  st->fixed = 0;
+
+  st->sync = st->shared ? shared_memory(sizeof(SYNC)) : NULL;
+  partition(st,0,1);
+
+  return st;
+}
+
+
+/* Compare the labels of two metadata values of a model */
+
+int cmpvalue(const void *a, const void *b)
+{
+  return strcmp(((MVALUE*)a)->label,((MVALUE*)b)->label);
+}
+
+
+/* Give a state the parameters of the model in its context, and fix them.
+ * Metadata values not in the model get the model's overall fractions of
+ * vertices in each group as their priors. */
+
+void use_model(SBM *sbm, STATE *st)
+{
+  int K=sbm->K;
+  int i,r;
+  MODEL *model=sbm->model;
+  MVALUE key,*value;
+
+  for (r=0; r<K*K; r++) st->omega[r] = model->c[r]/sbm->twom;
+  for (i=0; i<sbm->nmlabels; i++) {
+    key.label = sbm->mlabel[i];
+    value = bsearch(&key,model->value,model->nvalues,sizeof(MVALUE),cmpvalue);
+    for (r=0; r<K; r++) {
+      st->gmma[r][i] = (value!=NULL) ? value->gmma[r] : model->prior[r];
+    }
+  }
+  st->fixed = 1;
+}
+
+
+/* Make a new state for a run of the EM algorithm, with its own random
+ * number generator started from the given seed, and choose random initial
+ * values.  If there is a model, the parameters are its instead. */
+
+STATE *new_state(SBM *sbm, unsigned long seed)
+{
+  int K=sbm->K;
+  int u,v,i,r,s;
+  double *c;
+  STATE *st;
+  NETWORK *G=&sbm->G;
+
+  st = alloc_state(sbm,seed);
+
+  // Initialize the marginals to random values
+
+  for (i=0; i<G->nvertices; i++) {
+    random_unity(st->rng,K,st->q+K*renumbered(sbm,i));
+  }
+
+  // Initialize the messages to the same values as the marginals
+
+  for (u=0; u<G->nvertices; u++) {
+    for (i=0; i<G->vertex[u].degree; i++) {
+      v = G->vertex[u].edge[i].target;
+      for (r=0; r<K; r++) {
+	store_p(st->precision,st->eta,K*(G->vertex[u].offset+i)+r,st->q[K*v+r]);
+      }
+    }
+  }
+
+  // Choose random initial values for the gammas
+
+  c = malloc(K*K*sizeof(double));
+  for (i=0; i<sbm->nmlabels; i++) {
+    random_unity(st->rng,K,c);
+    for (r=0; r<K; r++) st->gmma[r][i] = c[r];
+  }
+
+  // Choose random values for the omegas, but with a bias toward
+  // assortative choices (change if necessary for other networks)
+
+  for (r=0; r<K; r++) {
+    for (s=0; s<K; s++) {
+      if (r==s) c[K*r+s] = 1 + gsl_rng_uniform(st->rng);
+      else if (r<s) c[K*r+s] = gsl_rng_uniform(st->rng);
+      else c[K*r+s] = c[K*s+r];
+      st->omega[K*r+s] = c[K*r+s]/sbm->twom;
+    }
+  }
+  free(c);
+  if (sbm->model!=NULL) use_model(sbm,st);
+
+  return st;
+}
+
+
+/* Make a new state with one more group than the state parent, by splitting
+ * group t of the parent in two.  The other groups carry over unchanged.
+ * Each vertex's share of group t is divided between the two halves at
+ * random, and the messages from it likewise, so that the halves don't
+ * start out the same.  The new group, numbered last, starts with the same
+ * prior and mixing parameters as group t, except that the mixing between
+ * the two halves is reduced by a random factor, which biases them toward
+ * an assortative split as in new_state() */
+
+STATE *split_state(SBM *sbm, STATE *parent, int t, unsigned long seed)
+{
+  int K=sbm->K;
+  int k=parent->K;
+  int u,v,i,r,s;
+  long e;
+  double *f;
+  double eta[K];
+  STATE *st;
+  NETWORK *G=&sbm->G;
+
+  st = alloc_state(sbm,seed);
+
+  // Choose the fraction of each vertex's share of group t that goes into
+  // the first half, and split the marginals
+
+  f = malloc(G->nvertices*sizeof(double));
+  for (i=0; i<G->nvertices; i++) {
+    f[renumbered(sbm,i)] = gsl_rng_uniform(st->rng);
+  }
+  for (u=0; u<G->nvertices; u++) {
+    for (r=0; r<k; r++) st->q[K*u+r] = parent->q[k*u+r];
+    st->q[K*u+t] = f[u]*parent->q[k*u+t];
+    st->q[K*u+k] = (1-f[u])*parent->q[k*u+t];
+  }
+
+  // Split the messages in the same proportions as the marginals of the
+  // vertices they come from
+
+  for (u=0; u<G->nvertices; u++) {
+    for (i=0; i<G->vertex[u].degree; i++) {
+      e = G->vertex[u].offset + i;
+      v = G->vertex[u].edge[i].target;
+      for (r=0; r<k; r++) eta[r] = load_p(parent->precision,parent->eta,k*e+r);
+      eta[k] = (1-f[v])*eta[t];
+      eta[t] = f[v]*eta[t];
+      for (r=0; r<K; r++) store_p(st->precision,st->eta,K*e+r,eta[r]);
+    }
+  }
+  free(f);
+
+  // Divide the prior for group t equally between the halves
+
+  for (i=0; i<sbm->nmlabels; i++) {
+    for (r=0; r<k; r++) st->gmma[r][i] = parent->gmma[r][i];
+    st->gmma[t][i] = st->gmma[k][i] = 0.5*parent->gmma[t][i];
+  }
+
+  // Copy the mixing parameters of group t to the new group, then reduce
+  // the mixing between the halves
+
+  for (r=0; r<k; r++) {
+    for (s=0; s<k; s++) st->omega[K*r+s] = parent->omega[k*r+s];
+    st->omega[K*r+k] = st->omega[K*k+r] = parent->omega[k*r+t];
+  }
+  st->omega[K*k+k] = parent->omega[k*t+t];
+  st->omega[K*t+k] = st->omega[K*k+t]
+    = gsl_rng_uniform(st->rng)*parent->omega[k*t+t];
+
+  return st;
+}
+
+
+/* Free a state again */
+
+void free_state(STATE *st)
+{
+  int r;
+  int K=st->K;
+  int n=st->nvertices;
+
+  for (r=0; r<K; r++) {
+    free(st->gmma[r]);
+    free_state_array(st,st->nrx[r],st->nmlabels*sizeof(double));
+  }
+  free(st->gmma);
+  free(st->nrx);
+  free(st->omega);
+  free_edge_array(st->eta,st->etasize,st->mapped);
+  free_state_array(st,st->q,K*n*sizeof(double));
+  free_state_array(st,st->field,K*n*sizeof(double));
+  free_state_array(st,st->nsmall,K*n*sizeof(int));
+  free_edge_array(st->logterm,st->termsize,st->mapped);
+  free_state_array(st,st->partial,st->partialsize);
+  if (st->sync!=NULL) munmap(st->sync,sizeof(SYNC));
+  free(st->loggmma);
+  free(st->residual);
+  free(st->heap);
+  free(st->heappos);
+  free(st->sweep);
+  free(st->step);
+  gsl_rng_free(st->rng);
+  free(st);
+}
+
+
+/* Decide whether a run is clearly losing.  Its last three values of the
+ * log-likelihood are extrapolated to their limit, assuming they converge
+ * geometrically, and the run is losing if even the limit falls short of
+ * the best finished run by more than PRUNE_MARGIN.  Runs whose
+ * log-likelihood is not yet converging steadily are never losing */
+
+int losing(SBM *sbm, double L0, double L1, double L2)
+{
+  double rho,limit,best;
+
+#pragma omp critical(best)
+  best = (sbm->nfinished>0) ? sbm->bestL : HUGE_VAL;
+  if (best==HUGE_VAL) return 0;
+
+  if ((L1<=L0)||(L2<L1)||(L2-L1>=L1-L0)) return 0;
+  rho = (L2-L1)/(L1-L0);
+  limit = L2 + (L2-L1)*rho/(1-rho);
+
+  return limit<best-PRUNE_MARGIN*fabs(best);
+}
+
+
+/* Record an EM step */
+
+void record_emstep(STATE *st, EMSTEP *rec)
+{
+  if (st->nstep==st->stepspace) {
+    st->stepspace = 2*st->stepspace + 16;
+    st->step = realloc(st->step,st->stepspace*sizeof(EMSTEP));
+  }
+  st->step[st->nstep++] = *rec;
+}
+
+
+/* Checkpoints.  With sbm_set_checkpoint(), a single run saves its state
+ * every so often, at the end of an EM step, so that the calculation can
+ * be picked up again with sbm_resume() if it's interrupted.  The state at
+ * the end of an EM step is just the messages, the marginals, and the
+ * parameters (BP recalculates everything else from these), plus a few
+ * counters, so the resumed run does exactly the same arithmetic as one
+ * that was never interrupted, and gets the same result.
+ *
+ * So as not to hold up the calculation, the state is copied into a buffer
+ * and written to the file by a separate thread, while the EM algorithm
+ * carries on.  If the last checkpoint is still being written when the
+ * next is due, the next is skipped.  Each is written to a temporary file
+ * that replaces the old checkpoint only when it's complete, so there is
+ * always a whole checkpoint to go back to.
+ *
+ * The file is a header followed by q, eta, gamma, and omega as arrays of
+ * doubles, except that eta is stored with the run's precision.  The header
+ * holds a fingerprint of the network and metadata, so that a checkpoint
+ * can't be resumed on the wrong network, and a checksum of the rest of the
+ * file. */
+
+#define CK_MAGIC "SBMCKPT"     // First 8 bytes of every checkpoint
+#define CK_VERSION 1
+#define CK_BYTEORDER 0x01020304
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  int32_t K;
+  int32_t schedule;
+  int32_t nvertices;
+  int32_t nmlabels;
+  int64_t nedges;
+  uint64_t fingerprint;        // Of the network and metadata
+  uint64_t seed;
+  int32_t step;                // Number of EM steps done
+  int32_t precision;           // Storage of eta
+  int64_t updates;
+  int64_t sweeps;
+  double L;
+  double Lhist[3];
+  int64_t length;              // Total length of the file
+  uint64_t checksum;           // Of everything after the header
+} CK_HEADER;
+
+struct checkpoint {
+  char *filename;      // File to write
+  char *tmpname;       // Temporary file it's written to first
+  double interval;     // Seconds between checkpoints
+  double last;         // Wall-clock time of the last one
+  char *data;          // Header and arrays of the one being written
+  size_t size;
+  size_t space;
+  int busy;            // Set while the writing thread is running
+  int started;         // Set if a thread has been started and not joined
+  int failed;          // Set if writing a checkpoint failed
+  pthread_t thread;
+};
+
+
+/* Fingerprint of the network and metadata, a hash of the edges, their
+ * multiplicities and weights, and the metadata value of every vertex */
+
+uint64_t mix(uint64_t h, uint64_t word)
+{
+  return (h^word)*0x100000001b3ULL;
+}
+
+uint64_t fingerprint(SBM *sbm)
+{
+  int u;
+  long e;
+  uint64_t h=0xcbf29ce484222325ULL,weight;
+  NETWORK *G=&sbm->G;
+
+  h = mix(h,G->nvertices);
+  h = mix(h,G->nedges);
+  for (u=0; u<G->nvertices; u++) h = mix(h,sbm->x[u]);
+  for (e=0; e<G->nedges; e++) {
+    memcpy(&weight,&G->edge[e].weight,sizeof(double));
+    h = mix(h,G->edge[e].target);
+    h = mix(h,G->edge[e].multiplicity);
+    h = mix(h,weight);
+  }
+
+  return h;
+}
+
+
+/* Thread that writes a checkpoint from the buffer, checksumming it first */
+
+void *write_checkpoint(void *arg)
+{
+  CHECKPOINT *ck=arg;
+  CK_HEADER *h=(CK_HEADER*)ck->data;
+  FILE *stream;
+
+#ifdef _OPENMP
+  omp_set_num_threads(1);      // Leave the cores to the calculation
+#endif
+  h->checksum = checksum(ck->data+sizeof(CK_HEADER),
+			 ck->size-sizeof(CK_HEADER));
+  stream = fopen(ck->tmpname,"w");
+  if ((stream==NULL)||(fwrite(ck->data,1,ck->size,stream)!=ck->size)
+      ||(fflush(stream)!=0)||(fsync(fileno(stream))!=0)) {
+    fprintf(stderr,"Unable to write checkpoint %s\n",ck->tmpname);
+    if (stream!=NULL) fclose(stream);
+    ck->failed = 1;
+  } else {
+    fclose(stream);
+    if (rename(ck->tmpname,ck->filename)!=0) {
+      fprintf(stderr,"Unable to replace checkpoint %s\n",ck->filename);
+      ck->failed = 1;
+    }
+  }
+
+  __atomic_store_n(&ck->busy,0,__ATOMIC_RELEASE);
+  return NULL;
+}
+
+
+/* Wait for the last checkpoint to be written */
+
+void finish_checkpoint(CHECKPOINT *ck)
+{
+  if ((ck!=NULL)&&ck->started) {
+    pthread_join(ck->thread,NULL);
+    ck->started = 0;
+  }
+}
+
+
+/* Save a checkpoint of a run that has done the given number of EM steps,
+ * if it's time for one and the last one has been written */
+
+void save_checkpoint(STATE *st, int step)
+{
+  SBM *sbm=st->sbm;
+  CHECKPOINT *ck=sbm->checkpoint;
+  NETWORK *G=&sbm->G;
+  int K=st->K;
+  int r;
+  size_t size;
+  char *p;
+  CK_HEADER *h;
+
+  if (sbm->nruns>1) return;
+  if (wall_time()-ck->last<ck->interval) return;
+  if (__atomic_load_n(&ck->busy,__ATOMIC_ACQUIRE)) return;
+  finish_checkpoint(ck);
+
+  // Copy the state into the buffer
+
+  size = sizeof(CK_HEADER) + K*G->nedges*storage_size(st->precision)
+    + (K*(G->nvertices+sbm->nmlabels+K))*sizeof(double);
+  if (size>ck->space) {
+    free(ck->data);
+    ck->data = malloc(size);
+    ck->space = size;
+  }
+  ck->size = size;
+
+  h = (CK_HEADER*)ck->data;
+  memset(h,0,sizeof(CK_HEADER));
+  memcpy(h->magic,CK_MAGIC,8);
+  h->version = CK_VERSION;
+  h->byteorder = CK_BYTEORDER;
+  h->K = K;
+  h->schedule = sbm->schedule;
+  h->nvertices = G->nvertices;
+  h->nmlabels = sbm->nmlabels;
+  h->nedges = G->nedges;
+  h->fingerprint = sbm->fingerprint;
+  h->seed = st->seed;
+  h->step = step;
+  h->precision = st->precision;
+  h->updates = st->updates;
+  h->sweeps = st->sweeps;
+  h->L = st->L;
+  for (r=0; r<3; r++) h->Lhist[r] = st->Lhist[r];
+  h->length = size;
+
+  p = ck->data + sizeof(CK_HEADER);
+  memcpy(p,st->q,K*G->nvertices*sizeof(double));
+  p += K*G->nvertices*sizeof(double);
+  memcpy(p,st->eta,K*G->nedges*storage_size(st->precision));
+  p += K*G->nedges*storage_size(st->precision);
+  for (r=0; r<K; r++) {
+    memcpy(p,st->gmma[r],sbm->nmlabels*sizeof(double));
+    p += sbm->nmlabels*sizeof(double);
+  }
+  memcpy(p,st->omega,K*K*sizeof(double));
+
+  // Hand it to a thread to write
+
+  ck->busy = 1;
+  if (pthread_create(&ck->thread,NULL,write_checkpoint,ck)!=0) {
+    fprintf(stderr,"Unable to start thread to write checkpoint\n");
+    ck->busy = 0;
+    ck->failed = 1;
+    return;
+  }
+  ck->started = 1;
+  ck->last = wall_time();
+}
+
+
+/* Read a checkpoint and make a state from it, setting the number of
+ * groups, the schedule, and the precision to the ones it was saved with.
+ * Returns NULL if the checkpoint can't be read or is for a different
+ * network */
+
+STATE *read_checkpoint(SBM *sbm, char *filename)
+{
+  int r;
+  long length;
+  char *data,*p;
+  CK_HEADER *h;
+  STATE *st;
+  NETWORK *G=&sbm->G;
+  FILE *stream;
+
+  stream = fopen(filename,"r");
+  if (stream==NULL) {
+    fprintf(stderr,"Unable to open checkpoint %s\n",filename);
+    return NULL;
+  }
+  fseek(stream,0,SEEK_END);
+  length = ftell(stream);
+  rewind(stream);
+  if (length<(long)sizeof(CK_HEADER)) {
+    fprintf(stderr,"%s is not a checkpoint\n",filename);
+    fclose(stream);
+    return NULL;
+  }
+  data = malloc(length);
+  if (fread(data,1,length,stream)!=length) {
+    fprintf(stderr,"Unable to read checkpoint %s\n",filename);
+    fclose(stream);
+    free(data);
+    return NULL;
+  }
+  fclose(stream);
+  h = (CK_HEADER*)data;
+
+  // Check it
+
+  st = NULL;
+  if (memcmp(h->magic,CK_MAGIC,8)!=0) {
+    fprintf(stderr,"%s is not a checkpoint\n",filename);
+  } else if ((h->version!=CK_VERSION)||(h->byteorder!=CK_BYTEORDER)) {
+    fprintf(stderr,"Checkpoint %s was written by an incompatible version "
+	    "or machine\n",filename);
+  } else if ((h->length!=length)||(h->K<1)||(h->nmlabels<0)
+	     ||(h->nvertices<0)||(h->nedges<0)||(h->precision<0)
+	     ||(h->precision>SBM_BFLOAT16)
+	     ||(length!=sizeof(CK_HEADER)+h->K*h->nedges
+		*storage_size(h->precision)
+		+(h->K*(h->nvertices+h->nmlabels+h->K))*sizeof(double))) {
+    fprintf(stderr,"Checkpoint %s is truncated or damaged\n",filename);
+  } else if (checksum(data+sizeof(CK_HEADER),length-sizeof(CK_HEADER))
+	     !=h->checksum) {
+    fprintf(stderr,"Checksum error in checkpoint %s\n",filename);
+  } else if ((h->nvertices!=G->nvertices)||(h->nedges!=G->nedges)
+	     ||(h->nmlabels!=sbm->nmlabels)
+	     ||(h->fingerprint!=fingerprint(sbm))) {
+    fprintf(stderr,"Checkpoint %s is for a different network\n",filename);
+  } else {
+
+    // Make the state
+
+    sbm->K = h->K;
+    sbm->schedule = h->schedule;
+    sbm->precision = h->precision;
+    st = alloc_state(sbm,h->seed);
+    st->emsteps = h->step;
+    st->updates = h->updates;
+    st->sweeps = h->sweeps;
+    st->L = h->L;
+    for (r=0; r<3; r++) st->Lhist[r] = h->Lhist[r];
+
+    p = data + sizeof(CK_HEADER);
+    memcpy(st->q,p,st->K*G->nvertices*sizeof(double));
+    p += st->K*G->nvertices*sizeof(double);
+    memcpy(st->eta,p,st->K*G->nedges*storage_size(st->precision));
+    p += st->K*G->nedges*storage_size(st->precision);
+    for (r=0; r<st->K; r++) {
+      memcpy(st->gmma[r],p,sbm->nmlabels*sizeof(double));
+      p += sbm->nmlabels*sizeof(double);
+    }
+    memcpy(st->omega,p,st->K*st->K*sizeof(double));
+  }
+
+  free(data);
+  return st;
+}
+
+
+/* Run the EM algorithm from the current state until the c's stop changing.
+ * If prune is set, give up if the run is clearly losing to the best
+ * finished run so far and return 1.  Otherwise return 0. */
+
+int em(STATE *st, int prune)
+{
+  SBM *sbm=st->sbm;
+  int K=sbm->K;
+  int r,s;
+  int step;
+  double deltac,maxdelta;
+  double wall,cpu;
+  double *c,*oldc;
+  double *Lhist=st->Lhist;
+  EMSTEP rec;
+
+  c = malloc(K*K*sizeof(double));
+  oldc = malloc(K*K*sizeof(double));
+  for (r=0; r<K*K; r++) c[r] = st->omega[r]*sbm->twom;
+
+  // EM loop
+
+  step = st->emsteps;
+  if (sbm->progress) {
+    if (st->fixed) fprintf(stderr,"Running BP with fixed parameters...\n");
+    else if (step==0) fprintf(stderr,"Starting EM algorithm...\n");
+    else fprintf(stderr,"Resuming EM algorithm after step %i...\n",step-1);
+  }
+  do {
+
+    // Run BP to calculate the messages and one-vertex marginals
+
+    rec.firstsweep = st->nsweep;
+    rec.updates = st->updates;
+    wall = wall_time();
+    cpu = cpu_time();
+    st->bpsteps = bp(st);
+    rec.bpwall = wall_time() - wall;
+    rec.bpcpu = cpu_time() - cpu;
+
+    // Calculate the new values of the parameters
+
+    wall = wall_time();
+    cpu = cpu_time();
+    st->L = params(st);
+    rec.paramswall = wall_time() - wall;
+    rec.paramscpu = cpu_time() - cpu;
+
+    // Calculate the new values of the c variables
+
+    for (r=0; r<K; r++) {
+      for (s=0; s<K; s++) {
+	oldc[K*r+s] = c[K*r+s];
+	c[K*r+s] = st->omega[K*r+s]*sbm->twom;
+      }
+    }
+
+    // Find the largest change in any of the c's
+
+    maxdelta = 0.0;
+    for (r=0; r<K; r++) {
+      for (s=0; s<K; s++) {
+	deltac = fabs(c[K*r+s]-oldc[K*r+s]);
+        if (deltac>maxdelta) maxdelta = deltac;
+      }
+    }
+
+    // Record the step, and report on it if asked
+
+    rec.bpsteps = st->bpsteps;
+    rec.updates = st->updates - rec.updates;
+    rec.change = maxdelta;
+    rec.L = st->L;
+    record_emstep(st,&rec);
+    st->tbp += rec.bpwall;
+    st->tparams += rec.paramswall;
+    if (sbm->progress) {
+      fprintf(stderr,"EM step %i: log-likelihood = %g, max change = %g, "
+	      "%i BP steps\n",step,st->L,maxdelta,st->bpsteps);
+    }
+
+    // Give up on losing runs
+
+    Lhist[0] = Lhist[1];
+    Lhist[1] = Lhist[2];
+    Lhist[2] = st->L;
+    if (prune&&(step>=PRUNE_MINSTEP)&&losing(sbm,Lhist[0],Lhist[1],Lhist[2])) {
+      st->emsteps = step + 1;
+      free(c);
+      free(oldc);
+      return 1;
+    }
+
+    if (++step>EM_MAXSTEP) {
+#ifdef NOCONVERGE
+      fprintf(stderr,"Solution failed to converge in %i EM steps\n",
+	      EM_MAXSTEP);
+      break;
+#endif
+    }
+
+    // Save a checkpoint if one is due
+
+    if ((sbm->checkpoint!=NULL)&&(maxdelta>EM_ACC)) save_checkpoint(st,step);
+
+  } while (maxdelta>EM_ACC);
+
+#ifdef NOCONVERGE
+  if (st->bpsteps>BP_MAXSTEP) {
+    fprintf(stderr,"BP failed converge on final EM step\n");
+  }
+#endif
+
+  st->emsteps = step;
+  free(c);
+  free(oldc);
+  return 0;
+}
+
+/* Do the EM algorithm for one run with its work divided among sbm->nprocs
+ * processes.  The state's arrays are in memory shared by all the processes
+ * (see alloc_state()), and process zero, the one calling this function,
+ * makes the others with fork().  Each process does its share of every BP
+ * sweep and parameter calculation, as set by partition(), on a single
+ * thread, with a barrier between passes.  The reductions are done by every
+ * process from the per-block partial results in shared memory, always in
+ * block order, so every process calculates the same parameters and makes
+ * the same decisions, and the results are the same as with one process.
+ * Only process zero reports progress and saves checkpoints.  When the run
+ * has converged the others exit, leaving the results in the shared
+ * memory.  Returns the result of em(). */
+
+int em_processes(STATE *st, int prune)
+{
+  SBM *sbm=st->sbm;
+  int i,status,result;
+  pid_t *child;
+
+  st->parent = getpid();
+  st->sync->count = st->sync->generation = 0;
+  child = malloc(sbm->nprocs*sizeof(pid_t));
+  for (i=1; i<sbm->nprocs; i++) {
+    child[i] = fork();
+    if (child[i]<0) {
+      fprintf(stderr,"Unable to start worker process\n");
+      exit(25);
+    }
+    if (child[i]==0) {
+      sbm->progress = 0;
+      sbm->checkpoint = NULL;
+      partition(st,i,sbm->nprocs);
+      em(st,prune);
+      _exit(0);
+    }
+  }
+
+  partition(st,0,sbm->nprocs);
+  result = em(st,prune);
+  for (i=1; i<sbm->nprocs; i++) {
+    if ((waitpid(child[i],&status,0)!=child[i])||!WIFEXITED(status)
+	||(WEXITSTATUS(status)!=0)) {
+      fprintf(stderr,"Worker process failed\n");
+      exit(25);
+    }
+  }
+  partition(st,0,1);
+  free(child);
+
+  return result;
+}
+
+
+/* Make the metadata lists and the blocks for a newly read network, and
+ * check that every edge has an edge leading back, which BP needs.  Returns
+ * zero on success */
+
+int prepare(SBM *sbm)
+{
+  int u;
+  long e;
+  double start,cstart;
+  int *order;
+  NETWORK *G=&sbm->G;
+
+  // Renumber the vertices if asked.  If they have been renumbered before,
+  // the new numbering is relative to that one, so compose the two.
+
+  order = NULL;
+  if (sbm->ordering!=sbm->orderedby) order = network_order(G,sbm->ordering);
+  if (order!=NULL) {
+    reorder_network(G,order);
+    if (sbm->order!=NULL) {
+      for (u=0; u<G->nvertices; u++) order[u] = sbm->order[order[u]];
+      free(sbm->order);
+    }
+    sbm->order = order;
+    sbm->rank = realloc(sbm->rank,G->nvertices*sizeof(int));
+    for (u=0; u<G->nvertices; u++) sbm->rank[order[u]] = u;
+    sbm->orderedby = sbm->ordering;
+  }
+
+  if ((sbm->scratch!=NULL)&&!edges_mapped(G)&&(spill_network(sbm)!=0)) {
+    return 1;
+  }
+  for (e=0; e<G->nedges; e++) {
+    if (G->edge[e].twin<0) {
+      fprintf(stderr,"Network must be undirected\n");
+      return 1;
+    }
+  }
+
+  start = wall_time();
+  cstart = cpu_time();
+  for (u=sbm->twom=0; u<G->nvertices; u++) {
+    sbm->twom += G->vertex[u].multidegree;
+  }
+  get_metadata(sbm);
+  group_metadata(sbm);
+  make_blocks(sbm);
+  sbm->ready = 1;
+  sbm->tmetadata = wall_time() - start;
+  sbm->cmetadata = cpu_time() - cstart;
+
+  return 0;
+}
+
+
+/* Free the results of the last calculation */
+
+void free_results(SBM *sbm)
+{
+  if (sbm->best!=NULL) free_state(sbm->best);
+  sbm->best = NULL;
+  free(sbm->marginals);
+  sbm->marginals = NULL;
+}
+
+
+/* Free everything made from the network by prepare(), so that it will be
+ * made again next time, as when the network changes */
+
+void free_prepared(SBM *sbm)
+{
+  free_results(sbm);
+  free(sbm->x);
+  free(sbm->mlabel);
+  free(sbm->nx);
+  free(sbm->xstart);
+  free(sbm->xvertex);
+  free(sbm->vblock);
+  free(sbm->eblock);
+  free(sbm->eblockvertex);
+  free(sbm->esource);
+  sbm->x = sbm->nx = sbm->xstart = sbm->xvertex = NULL;
+  sbm->mlabel = NULL;
+  sbm->vblock = sbm->eblockvertex = sbm->esource = NULL;
+  sbm->eblock = NULL;
+  sbm->ready = 0;
+}
+
+
+/* Free the model, if there is one */
+
+void free_model(SBM *sbm)
+{
+  int i;
+  MODEL *model=sbm->model;
+
+  if (model==NULL) return;
+  for (i=0; i<model->nvalues; i++) free(model->value[i].label);
+  free(model->value);
+  free(model->gmma);
+  free(model->c);
+  free(model->prior);
+  free(model);
+  sbm->model = NULL;
+}
+
+
+/* Throw away the changes queued for sbm_update() */
+
+void clear_changes(SBM *sbm)
+{
+  int i;
+
+  for (i=0; i<sbm->nrelabel; i++) free(sbm->newlabel[i]);
+  for (i=0; i<sbm->nnew; i++) free(sbm->newvertex[i]);
+  sbm->nadd = sbm->nremove = sbm->nrelabel = sbm->nnew = 0;
+}
+
+
+/* Free the network, if there is one, ready to read another */
+
+void free_loaded(SBM *sbm)
+{
+  free_prepared(sbm);
+  if (sbm->loaded) free_network(&sbm->G);
+  sbm->loaded = 0;
+  free(sbm->order);
+  free(sbm->rank);
+  sbm->order = sbm->rank = NULL;
+  sbm->orderedby = REORDER_NONE;
+  clear_changes(sbm);
+}
+
+
+/* Make a new context with the default options and no network */
+
+SBM *sbm_new(void)
+{
+  SBM *sbm;
+
+  sbm = calloc(1,sizeof(SBM));
+  sbm->K = KDEFAULT;
+  sbm->schedule = SBM_FLOOD;
+  sbm->nruns = 1;
+  sbm->nprocs = 1;
+
+  return sbm;
+}
+
+
+/* Free a context and everything in it */
+
+void sbm_free(SBM *sbm)
+{
+  free_loaded(sbm);
+  sbm_set_checkpoint(sbm,NULL,0.0);
+  free(sbm->scratch);
+  free(sbm->add);
+  free(sbm->remove);
+  free(sbm->relabel);
+  free(sbm->newlabel);
+  free(sbm->newvertex);
+  free_model(sbm);
+  free(sbm);
+}
+
+
+/* Functions to read the network and metadata, replacing any network read
+ * before, from a GML file, an edge list and metadata file, or a snapshot.
+ * Each returns zero on success */
+
+int sbm_read_gml(SBM *sbm, FILE *stream)
+{
+  double start,cstart;
+
+  free_loaded(sbm);
+  start = wall_time();
+  cstart = cpu_time();
+  if (read_network(&sbm->G,stream)!=0) return 1;
+  sbm->loaded = 1;
+  sbm->tread = wall_time() - start;
+  sbm->cread = cpu_time() - cstart;
+  return 0;
+}
+
+int sbm_read_edgelist(SBM *sbm, char *edgefile, char *labelfile)
+{
+  double start,cstart;
+
+  free_loaded(sbm);
+  start = wall_time();
+  cstart = cpu_time();
+  if (read_edgelist(&sbm->G,edgefile,labelfile)!=0) return 1;
+  sbm->loaded = 1;
+  sbm->tread = wall_time() - start;
+  sbm->cread = cpu_time() - cstart;
+  return 0;
+}
+
+int sbm_read_snapshot(SBM *sbm, char *filename)
+{
+  double start,cstart;
+
+  free_loaded(sbm);
+  start = wall_time();
+  cstart = cpu_time();
+  if (read_snapshot(filename,&sbm->G)!=0) return 1;
+  sbm->loaded = 1;
+  sbm->tread = wall_time() - start;
+  sbm->cread = cpu_time() - cstart;
+  return 0;
+}
+
+
+/* Save the network as a snapshot */
+
+int sbm_write_snapshot(SBM *sbm, char *filename)
+{
+  if (!sbm->loaded) return 1;
+  return write_snapshot(filename,&sbm->G);
+}
+
+
+/* Merge parallel edges.  See merge_edges() in readgml.c */
+
+void sbm_merge(SBM *sbm)
+{
+  if (!sbm->loaded) return;
+  free_prepared(sbm);
+  merge_edges(&sbm->G);
+}
+
+
+/* Get the network itself.  It should not be changed once sbm_run() has
+ * been called */
+
+NETWORK *sbm_network(SBM *sbm)
+{
+  return sbm->loaded ? &sbm->G : NULL;
+}
+
+
+/* Functions to set the options.  Changing the number of groups throws away
+ * the results of the last calculation, which have the old number */
+
+void sbm_set_groups(SBM *sbm, int k)
+{
+  free_results(sbm);
+  sbm->K = k;
+}
+
+void sbm_set_schedule(SBM *sbm, int schedule)
+{
+  sbm->schedule = schedule;
+}
+
+void sbm_set_restarts(SBM *sbm, int nruns)
+{
+  sbm->nruns = nruns;
+}
+
+void sbm_set_seed(SBM *sbm, unsigned long seed)
+{
+  sbm->seed = seed;
+}
+
+void sbm_set_prune(SBM *sbm, int prune)
+{
+  sbm->prune = prune;
+}
+
+void sbm_set_verbose(SBM *sbm, int verbose)
+{
+  sbm->verbose = verbose;
+}
+
+void sbm_set_precision(SBM *sbm, int precision)
+{
+  sbm->precision = precision;
+}
+
+void sbm_set_processes(SBM *sbm, int nprocs)
+{
+  sbm->nprocs = nprocs;
+}
+
+void sbm_set_order(SBM *sbm, int ordering)
+{
+  free_prepared(sbm);
+  sbm->ordering = ordering;
+}
+
+void sbm_set_scratch(SBM *sbm, char *dir)
+{
+  free_prepared(sbm);
+  free(sbm->scratch);
+  sbm->scratch = (dir!=NULL) ? strdup(dir) : NULL;
+}
+
+void sbm_set_checkpoint(SBM *sbm, char *filename, double interval)
+{
+  CHECKPOINT *ck=sbm->checkpoint;
+
+  if (ck!=NULL) {
+    finish_checkpoint(ck);
+    free(ck->filename);
+    free(ck->tmpname);
+    free(ck->data);
+    free(ck);
+    sbm->checkpoint = NULL;
+  }
+  if (filename==NULL) return;
+
+  ck = calloc(1,sizeof(CHECKPOINT));
+  ck->filename = strdup(filename);
+  ck->tmpname = malloc(strlen(filename)+5);
+  sprintf(ck->tmpname,"%s.tmp",filename);
+  ck->interval = interval;
+  sbm->checkpoint = ck;
+}
+
+
+/* Do the runs.  With a single run the threads share the work of each BP
+ * sweep; with several, each thread does whole runs, with run number i
+ * using seed+i, and we keep the one with the highest log-likelihood.  If
+ * parent is NULL, the runs start from random values.  Otherwise parent
+ * has one group fewer than we want, and run i starts from it with group
+ * split[i] divided in two. */
+
+void run_all(SBM *sbm, STATE *parent, int *split, STATE *resumed)
+{
+  int run;
+  int abandoned;
+  double small=SMALL;
+  double start=wall_time(),cstart=cpu_time();
+  double wall,cpu;
+  STATE *st,*best=NULL;
+
+  vlog(1,&small,&sbm->logsmall);
+  sbm->progress = sbm->verbose&&(sbm->nruns==1);
+  sbm->nfinished = 0;
+  sbm->emsteps = 0;
+  if (sbm->checkpoint!=NULL) {
+    sbm->checkpoint->last = start;
+    sbm->fingerprint = fingerprint(sbm);
+  }
+
+#pragma omp parallel for private(st,abandoned,wall,cpu) \
+  schedule(dynamic,1) \
+  if (sbm->nruns>1)
+  for (run=0; run<sbm->nruns; run++) {
+    if (resumed!=NULL) st = resumed;
+    else {
+      wall = wall_time();
+      cpu = cpu_time();
+      if (parent==NULL) st = new_state(sbm,sbm->seed+run);
+      else st = split_state(sbm,parent,split[run],sbm->seed+run);
+      st->initwall = wall_time() - wall;
+      st->initcpu = cpu_time() - cpu;
+    }
+    if (st->shared) abandoned = em_processes(st,sbm->prune);
+    else abandoned = em(st,sbm->prune);
+
+#pragma omp critical(best)
+    {
+      if (sbm->verbose&&(sbm->nruns>1)) {
+	if (abandoned) {
+	  fprintf(stderr,"Run %i abandoned after %i EM steps\n",
+		  run,st->emsteps);
+	} else {
+	  fprintf(stderr,"Run %i: log-likelihood = %g after %i EM steps\n",
+		  run,st->L,st->emsteps);
+	}
+      }
+      sbm->emsteps += st->emsteps;
+      if (!abandoned) {
+	if ((best==NULL)||(st->L>best->L)||isnan(best->L)) {
+	  if (best!=NULL) free_state(best);
+	  best = st;
+	  st = NULL;
+	}
+	sbm->bestL = best->L;
+	sbm->nfinished++;
+      }
+    }
+    if (st!=NULL) free_state(st);
+  }
+
+  finish_checkpoint(sbm->checkpoint);
+  sbm->best = best;
+  free(sbm->marginals);
+  sbm->marginals = NULL;
+  sbm->trun = wall_time() - start;
+  sbm->crun = cpu_time() - cstart;
+}
+
+
+/* Make ready to do the runs, returning zero if we can */
+
+int ready_to_run(SBM *sbm)
+{
+  if ((!sbm->loaded)||(sbm->K<1)||(sbm->nruns<1)) return 1;
+  if ((sbm->model!=NULL)&&(sbm->model->K!=sbm->K)) return 1;
+  if ((!sbm->ready)&&(prepare(sbm)!=0)) return 1;
+  if ((sbm->schedule==SBM_RESIDUAL)&&(sbm->esource==NULL)) make_sources(sbm);
+  return 0;
+}
+
+
+/* Do the runs from random starting points.  Returns zero on success */
+
+int sbm_run(SBM *sbm)
+{
+  if (ready_to_run(sbm)!=0) return 1;
+  free_results(sbm);
+  run_all(sbm,NULL,NULL,NULL);
+  return 0;
+}
+
+
+/* Carry on a run from a checkpoint saved by an earlier calculation on the
+ * same network, with the number of groups and the schedule it was saved
+ * with, which replace the ones set before.  Can't be done with a model.
+ * Returns zero on success */
+
+int sbm_resume(SBM *sbm, char *filename)
+{
+  double wall=wall_time(),cpu=cpu_time();
+  STATE *st;
+
+  if ((!sbm->loaded)||(sbm->model!=NULL)) return 1;
+  if ((!sbm->ready)&&(prepare(sbm)!=0)) return 1;
+  free_results(sbm);
+  st = read_checkpoint(sbm,filename);
+  if (st==NULL) return 1;
+  sbm->nruns = 1;
+  sbm->seed = st->seed;
+  if (ready_to_run(sbm)!=0) {
+    free_state(st);
+    return 1;
+  }
+  st->initwall = wall_time() - wall;
+  st->initcpu = cpu_time() - cpu;
+  run_all(sbm,NULL,NULL,st);
+  return 0;
+}
+
+
+/* Do the runs with one more group than the last calculation, starting
+ * from its best run with one group split in two.  The groups are split in
+ * order of their expected degrees, largest first, with run i splitting the
+ * (i mod K)th, so that with as many runs as groups every group gets split
+ * once.  Can't be done with a model.  Returns zero on success */
+
+int sbm_run_split(SBM *sbm)
+{
+  int u,r,s,t;
+  int k=sbm->K;
+  int *split,*order;
+  double *d;
+  STATE *parent=sbm->best;
+
+  if ((parent==NULL)||(sbm->model!=NULL)||(ready_to_run(sbm)!=0)) return 1;
+
+  // Find the expected degrees of the groups and put the groups in order
+
+  d = calloc(k,sizeof(double));
+  for (u=0; u<sbm->G.nvertices; u++) {
+    for (r=0; r<k; r++) d[r] += parent->q[k*u+r]*sbm->G.vertex[u].multidegree;
+  }
+  order = malloc(k*sizeof(int));
+  for (r=0; r<k; r++) {
+    for (s=r; (s>0)&&(d[order[s-1]]<d[r]); s--) order[s] = order[s-1];
+    order[s] = r;
+  }
+  split = malloc(sbm->nruns*sizeof(int));
+  for (t=0; t<sbm->nruns; t++) split[t] = order[t%k];
+
+  // Do the runs
+
+  sbm->best = NULL;
+  sbm->K = k + 1;
+  run_all(sbm,parent,split,NULL);
+  free_state(parent);
+
+  free(d);
+  free(order);
+  free(split);
+  return 0;
+}
+
+
+/* Add the pair u,v to the end of a list of pairs, making room if needed */
+
+void push_pair(int **list, int *n, int *space, int u, int v)
+{
+  if (*n==*space) {
+    *space = 2*(*space) + 64;
+    *list = realloc(*list,2*(*space)*sizeof(int));
+  }
+  (*list)[2*(*n)] = u;
+  (*list)[2*(*n)+1] = v;
+  (*n)++;
+}
+
+
+/* Functions to queue changes to the network, to be made by sbm_update().
+ * Vertices are numbered as in the results.  Each returns zero on success,
+ * or 1 if there is no such vertex, except sbm_add_vertex(), which returns
+ * the number the new vertex will have, following on from the vertices of
+ * the network and any other new ones, or -1 if there is no network. */
+
+int sbm_add_edge(SBM *sbm, int u, int v)
+{
+  int n=sbm->G.nvertices+sbm->nnew;
+
+  if ((!sbm->loaded)||(u<0)||(v<0)||(u>=n)||(v>=n)) return 1;
+  push_pair(&sbm->add,&sbm->nadd,&sbm->addspace,u,v);
+  return 0;
+}
+
+int sbm_remove_edge(SBM *sbm, int u, int v)
+{
+  int i;
+
+  if ((!sbm->loaded)||(u<0)||(v<0)||(u>=sbm->G.nvertices)
+      ||(v>=sbm->G.nvertices)) return 1;
+
+  // Removing an edge that is waiting to be added just cancels it
+
+  for (i=sbm->nadd-1; i>=0; i--) {
+    if (((sbm->add[2*i]==u)&&(sbm->add[2*i+1]==v))
+	||((sbm->add[2*i]==v)&&(sbm->add[2*i+1]==u))) {
+      sbm->nadd--;
+      sbm->add[2*i] = sbm->add[2*sbm->nadd];
+      sbm->add[2*i+1] = sbm->add[2*sbm->nadd+1];
+      return 0;
+    }
+  }
+  push_pair(&sbm->remove,&sbm->nremove,&sbm->removespace,u,v);
+  return 0;
+}
+
+int sbm_add_vertex(SBM *sbm, char *label)
+{
+  if (!sbm->loaded) return -1;
+  if (sbm->nnew==sbm->newspace) {
+    sbm->newspace = 2*sbm->newspace + 64;
+    sbm->newvertex = realloc(sbm->newvertex,sbm->newspace*sizeof(char*));
+  }
+  sbm->newvertex[sbm->nnew] = strdup(label);
+  return sbm->G.nvertices + sbm->nnew++;
+}
+
+int sbm_change_label(SBM *sbm, int u, char *label)
+{
+  if ((!sbm->loaded)||(u<0)||(u>=sbm->G.nvertices)) return 1;
+  if (sbm->nrelabel==sbm->relabelspace) {
+    sbm->relabelspace = 2*sbm->relabelspace + 64;
+    sbm->relabel = realloc(sbm->relabel,sbm->relabelspace*sizeof(int));
+    sbm->newlabel = realloc(sbm->newlabel,sbm->relabelspace*sizeof(char*));
+  }
+  sbm->relabel[sbm->nrelabel] = u;
+  sbm->newlabel[sbm->nrelabel++] = strdup(label);
+  return 0;
+}
+
+
+/* Give the vertices from first on, which are new, their marginals from
+ * the messages their neighbors send them, one vertex after another, and
+ * set the messages they send their neighbors in turn, leaving all the
+ * other messages and marginals as they are.  The parameters are those of
+ * the state, which are fixed.  The messages calculated are counted, and
+ * recorded as one sweep.  Used by sbm_update(). */
+
+void attach_vertices(STATE *st, int first)
+{
+  SBM *sbm=st->sbm;
+  NETWORK *G=&sbm->G;
+  int k=st->K,p=st->precision;
+  int u,v,i;
+  long e;
+  double logsmall=round_p(TERMS(p),sbm->logsmall);
+  double start=wall_time();
+  double delta,maxdelta=0.0;
+  double d[k];
+  double logpre[k];
+  double neweta[k];
+
+  loggammas_k(k,st);
+  prefactors_k(k,st,d,logpre);
+  for (u=first; u<G->nvertices; u++) {
+    terms_k(k,p,st,G->vertex[u].offset,G->vertex[u].degree);
+    field_k(k,p,st,u,logpre,logsmall);
+    for (i=0; i<G->vertex[u].degree; i++) {
+      v = G->vertex[u].edge[i].target;
+      e = G->vertex[v].offset + G->vertex[u].edge[i].twin;
+      delta = message_k(k,p,st,e,logpre,logsmall,neweta);
+      store_message_k(k,p,st,e,neweta);
+      if (delta>maxdelta) maxdelta = delta;
+    }
+    st->updates += G->vertex[u].degree;
+  }
+  st->sweeps++;
+  record_sweep(st,start,maxdelta);
+}
+
+
+/* Make the queued changes to the network and fit it again, starting from
+ * the results of the last calculation.  The messages on edges that are
+ * still there, the marginals, and the parameters carry over, with the
+ * gammas of any new metadata values starting out equal.  The messages on
+ * new edges start out equal to the marginals of the vertices they come
+ * from, as in new_state().  The fit then uses the residual schedule, so
+ * that BP updates only the messages the changes affect, which are usually
+ * a small part of the network, and the EM algorithm needs only a few steps
+ * to settle again.
+ *
+ * If the last calculation scored the network with a model, the parameters
+ * stay those of the model.  If, further, the only changes are new
+ * vertices, and edges that each have a new vertex at one end or both,
+ * the rest of the network is left alone: the new vertices get their
+ * marginals from the messages of their neighbors, one after another, and
+ * send their own messages back, but no other message or marginal changes.
+ *
+ * Returns zero on success, or 1 if there are no results to start from or
+ * an edge to be removed doesn't exist, in which case nothing is changed.
+ * Either way the queue is emptied. */
+
+int sbm_update(SBM *sbm)
+{
+  int K=sbm->K;
+  int n,u,i,j,r;
+  int nlabels;
+  long oldtwom;
+  int nruns,schedule;
+  int attach;
+  int *oldvalue;
+  long f;
+  long *oldpos;
+  double value;
+  double wall=wall_time(),cpu=cpu_time();
+  STATE *old,*st;
+  EMSTEP rec;
+  NETWORK *G=&sbm->G;
+
+  if (sbm->best==NULL) {
+    clear_changes(sbm);
+    return 1;
+  }
+  old = sbm->best;
+  n = G->nvertices;
+
+  // See whether the new vertices can be attached without touching the
+  // rest of the network
+
+  attach = old->fixed&&(sbm->nnew>0)&&(sbm->nremove==0)&&(sbm->nrelabel==0);
+  for (i=0; i<sbm->nadd; i++) {
+    if ((sbm->add[2*i]<n)&&(sbm->add[2*i+1]<n)) attach = 0;
+  }
+
+  // Add the new vertices, which keep their numbers if the others have
+  // been renumbered, then change the edges, in the network's own numbering
+
+  if (sbm->nnew>0) {
+    add_vertices(G,sbm->nnew,sbm->newvertex);
+    if (sbm->rank!=NULL) {
+      sbm->order = realloc(sbm->order,G->nvertices*sizeof(int));
+      sbm->rank = realloc(sbm->rank,G->nvertices*sizeof(int));
+      for (u=n; u<G->nvertices; u++) sbm->order[u] = sbm->rank[u] = u;
+    }
+  }
+  for (i=0; i<2*sbm->nadd; i++) sbm->add[i] = renumbered(sbm,sbm->add[i]);
+  for (i=0; i<2*sbm->nremove; i++) {
+    sbm->remove[i] = renumbered(sbm,sbm->remove[i]);
+  }
+  oldpos = change_edges(G,sbm->add,sbm->nadd,sbm->remove,sbm->nremove);
+  if (oldpos==NULL) {
+    fprintf(stderr,"Edge to be removed does not exist\n");
+    G->nvertices = n;
+    clear_changes(sbm);
+    return 1;
+  }
+
+  // Record the metadata value that went with each label, then change the
+  // labels
+
+  nlabels = G->nlabels;
+  oldvalue = malloc(nlabels*sizeof(int));
+  for (i=0; i<nlabels; i++) oldvalue[i] = -1;
+  for (u=0; u<n; u++) oldvalue[G->vertex[u].label] = sbm->x[u];
+  for (i=0; i<sbm->nrelabel; i++) {
+    u = renumbered(sbm,sbm->relabel[i]);
+    G->vertex[u].label = intern_label(G,sbm->newlabel[i],
+				      strlen(sbm->newlabel[i]));
+  }
+  clear_changes(sbm);
+
+  // Make the metadata lists and the blocks again, keeping the old results
+
+  sbm->best = NULL;
+  oldtwom = sbm->twom;
+  free_prepared(sbm);
+  if (prepare(sbm)!=0) {
+    free_state(old);
+    free(oldvalue);
+    free(oldpos);
+    return 1;
+  }
+
+  // Make the new state from the old one, for a single run with the
+  // residual schedule.  New vertices start out with equal marginals.
+
+  nruns = sbm->nruns;
+  schedule = sbm->schedule;
+  sbm->nruns = 1;
+  sbm->schedule = SBM_RESIDUAL;
+  make_sources(sbm);
+  st = alloc_state(sbm,old->seed);
+  memcpy(st->q,old->q,K*n*sizeof(double));
+  for (r=K*n; r<K*G->nvertices; r++) st->q[r] = 1.0/K;
+  for (f=0; f<G->nedges; f++) {
+    for (r=0; r<K; r++) {
+      if (oldpos[f]>=0) value = load_p(old->precision,old->eta,K*oldpos[f]+r);
+      else value = st->q[K*G->edge[f].target+r];
+      store_p(st->precision,st->eta,K*f+r,value);
+    }
+  }
+  if (old->fixed) use_model(sbm,st);
+  else {
+    for (i=0; i<sbm->nmlabels; i++) {
+      u = sbm->xvertex[sbm->xstart[i]];
+      j = (G->vertex[u].label<nlabels) ? oldvalue[G->vertex[u].label] : -1;
+      for (r=0; r<K; r++) st->gmma[r][i] = (j>=0) ? old->gmma[r][j] : 1.0/K;
+    }
+    for (r=0; r<K*K; r++) st->omega[r] = old->omega[r]*oldtwom/sbm->twom;
+  }
+  free_state(old);
+  free(oldvalue);
+  free(oldpos);
+  st->initwall = wall_time() - wall;
+  st->initcpu = cpu_time() - cpu;
+
+  // Attaching the new vertices counts as a single EM step, with one BP
+  // sweep and the parameters left as they are
+
+  if (attach) {
+    rec.firstsweep = st->nsweep;
+    rec.updates = st->updates;
+    rec.bpwall = wall_time();
+    rec.bpcpu = cpu_time();
+    attach_vertices(st,n);
+    rec.bpwall = wall_time() - rec.bpwall;
+    rec.bpcpu = cpu_time() - rec.bpcpu;
+    rec.paramswall = wall_time();
+    rec.paramscpu = cpu_time();
+    st->L = params(st);
+    rec.paramswall = wall_time() - rec.paramswall;
+    rec.paramscpu = cpu_time() - rec.paramscpu;
+    rec.bpsteps = st->bpsteps = 1;
+    rec.updates = st->updates - rec.updates;
+    rec.change = 0.0;
+    rec.L = st->L;
+    record_emstep(st,&rec);
+    st->tbp += rec.bpwall;
+    st->tparams += rec.paramswall;
+    st->emsteps = 1;
+    sbm->best = st;
+    sbm->bestL = st->L;
+    sbm->nfinished = 1;
+    sbm->emsteps = 1;
+    sbm->trun = wall_time() - wall;
+    sbm->crun = cpu_time() - cpu;
+  } else run_all(sbm,NULL,NULL,st);
+  sbm->nruns = nruns;
+  sbm->schedule = schedule;
+
+  return 0;
+}
+
+
+/* Functions to get the results of the best run.  The marginals are K for
+ * each vertex, in the order of the vertices in the network */
+
+int sbm_groups(SBM *sbm)
+{
+  return sbm->K;
+}
+
+int sbm_nvertices(SBM *sbm)
+{
+  return sbm->loaded ? sbm->G.nvertices : 0;
+}
+
+const double *sbm_marginals(SBM *sbm)
+{
+  int K=sbm->K;
+  int i;
+
+  if (sbm->best==NULL) return NULL;
+  if (sbm->rank==NULL) return sbm->best->q;
+
+  // Put the vertices back in their original order
+
+  if (sbm->marginals==NULL) {
+    sbm->marginals = malloc(K*sbm->G.nvertices*sizeof(double));
+    for (i=0; i<sbm->G.nvertices; i++) {
+      memcpy(sbm->marginals+K*i,sbm->best->q+K*sbm->rank[i],
+	     K*sizeof(double));
+    }
+  }
+  return sbm->marginals;
+}
+
+double sbm_omega(SBM *sbm, int r, int s)
+{
+  return (sbm->best!=NULL) ? sbm->best->omega[sbm->K*r+s] : NAN;
+}
+
+double sbm_gamma(SBM *sbm, int r, int i)
+{
+  return (sbm->best!=NULL) ? sbm->best->gmma[r][i] : NAN;
+}
+
+void sbm_stats(SBM *sbm, SBM_STATS *stats)
+{
+  int npar;
+  STATE *best=sbm->best;
+
+  stats->nfinished = (best!=NULL) ? sbm->nfinished : 0;
+  stats->totalemsteps = (best!=NULL) ? sbm->emsteps : 0;
+  stats->tread = sbm->tread;
+  stats->tmetadata = sbm->tmetadata;
+  stats->trun = sbm->trun;
+  if (best==NULL) {
+    stats->L = stats->score = NAN;
+    stats->run = -1;
+    stats->seed = 0;
+    stats->emsteps = 0;
+    stats->updates = stats->sweeps = 0;
+    stats->tbp = stats->tparams = 0.0;
+    return;
+  }
+  stats->L = best->L;
+  npar = sbm->K*(sbm->K+1)/2 + (sbm->K-1)*sbm->nmlabels;
+  stats->score = best->L - 0.5*npar*log(sbm->G.nvertices);
+  stats->run = best->seed - sbm->seed;
+  stats->seed = best->seed;
+  stats->emsteps = best->emsteps;
+  stats->updates = best->updates;
+  stats->sweeps = best->sweeps;
+  stats->tbp = best->tbp;
+  stats->tparams = best->tparams;
+}
+
+
+/* Write a number to a JSON file, as null if it is infinite or NaN, which
+ * JSON doesn't allow */
+
+void json_number(FILE *stream, char *format, double x)
+{
+  if (isfinite(x)) fprintf(stream,format,x);
+  else fprintf(stream,"null");
+}
+
+
+/* Write the statistics of the last calculation to a file, as JSON, or as
+ * CSV with one line per EM step of the best run if the file name ends in
+ * ".csv".  The JSON has the times taken by each phase of the calculation,
+ * the peak memory use, and a record of each EM step of the best run and
+ * of the BP sweeps within it.  Returns zero on success. */
+
+int sbm_write_stats(SBM *sbm, char *filename)
+{
+  int i,len,threads=1;
+  long j,end;
+  double bpcpu,paramscpu;
+  STATE *best=sbm->best;
+  EMSTEP *step;
+  struct rusage usage;
+  FILE *stream;
+
+  if (best==NULL) {
+    fprintf(stderr,"No results to write statistics for\n");
+    return 1;
+  }
+  stream = fopen(filename,"w");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",filename);
+    return 1;
+  }
+
+  // CSV, one line per EM step
+
+  len = strlen(filename);
+  if ((len>=4)&&(strcmp(filename+len-4,".csv")==0)) {
+    fprintf(stream,"step,bpsteps,bpdelta,updates,bpwall,bpcpu,paramswall,"
+	    "paramscpu,change,loglikelihood\n");
+    for (i=0; i<best->nstep; i++) {
+      step = &best->step[i];
+      end = (i<best->nstep-1) ? step[1].firstsweep : best->nsweep;
+      fprintf(stream,"%i,%i,%g,%li,%.6f,%.6f,%.6f,%.6f,%g,%.10g\n",i,
+	      step->bpsteps,best->sweep[end-1].maxdelta,step->updates,
+	      step->bpwall,step->bpcpu,step->paramswall,step->paramscpu,
+	      step->change,step->L);
+    }
+    fclose(stream);
+    return 0;
+  }
+
+  // JSON
+
+#ifdef _OPENMP
+  threads = omp_get_max_threads();
+#endif
+  getrusage(RUSAGE_SELF,&usage);
+  for (i=0,bpcpu=paramscpu=0.0; i<best->nstep; i++) {
+    bpcpu += best->step[i].bpcpu;
+    paramscpu += best->step[i].paramscpu;
+  }
+
+  fprintf(stream,"{\n  \"vertices\": %i,\n  \"edges\": %li,\n"
+	  "  \"values\": %i,\n  \"groups\": %i,\n  \"schedule\": \"%s\",\n"
+	  "  \"precision\": \"%s\",\n  \"restarts\": %i,\n"
+	  "  \"threads\": %i,\n",sbm->G.nvertices,sbm->G.nedges/2,
+	  sbm->nmlabels,sbm->K,
+	  sbm->schedule==SBM_RESIDUAL ? "residual" : "flood",
+	  best->precision==SBM_FLOAT ? "float" :
+	  best->precision==SBM_BFLOAT16 ? "bfloat16" : "double",sbm->nruns,
+	  threads);
+  fprintf(stream,"  \"phases\": {\n"
+	  "    \"read\": {\"wall\": %.6f, \"cpu\": %.6f},\n"
+	  "    \"metadata\": {\"wall\": %.6f, \"cpu\": %.6f},\n"
+	  "    \"init\": {\"wall\": %.6f, \"cpu\": %.6f},\n"
+	  "    \"bp\": {\"wall\": %.6f, \"cpu\": %.6f},\n"
+	  "    \"params\": {\"wall\": %.6f, \"cpu\": %.6f},\n"
+	  "    \"runs\": {\"wall\": %.6f, \"cpu\": %.6f}\n  },\n",
+	  sbm->tread,sbm->cread,sbm->tmetadata,sbm->cmetadata,
+	  best->initwall,best->initcpu,best->tbp,bpcpu,best->tparams,
+	  paramscpu,sbm->trun,sbm->crun);
+  fprintf(stream,"  \"peak_memory_kb\": %li,\n",usage.ru_maxrss);
+  fprintf(stream,"  \"best_run\": {\"run\": %li, \"seed\": %lu, "
+	  "\"emsteps\": %i, \"sweeps\": %li, \"updates\": %li, "
+	  "\"loglikelihood\": ",(long)(best->seed-sbm->seed),best->seed,
+	  best->emsteps,best->sweeps,best->updates);
+  json_number(stream,"%.10g",best->L);
+  fprintf(stream,"},\n  \"finished_runs\": %i,\n  \"total_emsteps\": %li,\n",
+	  sbm->nfinished,sbm->emsteps);
+
+  // The EM steps of the best run, and the sweeps of BP in each
+
+  fprintf(stream,"  \"em_steps\": [");
+  for (i=0; i<best->nstep; i++) {
+    step = &best->step[i];
+    end = (i<best->nstep-1) ? step[1].firstsweep : best->nsweep;
+    fprintf(stream,"%s\n    {\"step\": %i, \"bpsteps\": %i, "
+	    "\"updates\": %li, \"bpwall\": %.6f, \"bpcpu\": %.6f, "
+	    "\"paramswall\": %.6f, \"paramscpu\": %.6f, \"change\": ",
+	    i>0 ? "," : "",i,step->bpsteps,step->updates,step->bpwall,
+	    step->bpcpu,step->paramswall,step->paramscpu);
+    json_number(stream,"%g",step->change);
+    fprintf(stream,", \"loglikelihood\": ");
+    json_number(stream,"%.10g",step->L);
+    fprintf(stream,",\n     \"sweep_wall\": [");
+    for (j=step->firstsweep; j<end; j++) {
+      fprintf(stream,"%s%.6f",j>step->firstsweep ? ", " : "",
+	      best->sweep[j].wall);
+    }
+    fprintf(stream,"],\n     \"sweep_delta\": [");
+    for (j=step->firstsweep; j<end; j++) {
+      if (j>step->firstsweep) fprintf(stream,", ");
+      json_number(stream,"%g",best->sweep[j].maxdelta);
+    }
+    fprintf(stream,"]}");
+  }
+  fprintf(stream,"\n  ]\n}\n");
+
+  fclose(stream);
+  return 0;
+}
+
+
+/* Write the fitted model of the best run to a file, so that other networks
+ * can be scored with it later (see sbm_read_model()).  The file is text,
+ * with the number of groups and of metadata values, then the mixing
+ * parameters c, one row to a line, then one line for each metadata value
+ * with its number of vertices, its K priors, and its label.  Lines
+ * starting with "#" are comments.  Returns zero on success. */
+
+int sbm_write_model(SBM *sbm, char *filename)
+{
+  int K=sbm->K;
+  int i,r,s;
+  STATE *best=sbm->best;
+  FILE *stream;
+
+  if (best==NULL) {
+    fprintf(stderr,"No results to write a model for\n");
+    return 1;
+  }
+  stream = fopen(filename,"w");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",filename);
+    return 1;
+  }
+
+  fprintf(stream,"# Degree-corrected SBM with metadata: c = omega times "
+	  "twice the number\n# of edges, then count, gammas, and label of "
+	  "each metadata value\n");
+  fprintf(stream,"groups %i\nvalues %i\n",K,sbm->nmlabels);
+  for (r=0; r<K; r++) {
+    for (s=0; s<K; s++) {
+      fprintf(stream,"%s%.17g",s>0 ? " " : "",best->omega[K*r+s]*sbm->twom);
+    }
+    fprintf(stream,"\n");
+  }
+  for (i=0; i<sbm->nmlabels; i++) {
+    fprintf(stream,"%i",sbm->nx[i]);
+    for (r=0; r<K; r++) fprintf(stream," %.17g",best->gmma[r][i]);
+    fprintf(stream," %s\n",sbm->mlabel[i]);
+  }
+
+  if (fclose(stream)!=0) {
+    fprintf(stderr,"Error writing %s\n",filename);
+    return 1;
+  }
+  return 0;
+}
+
+
+/* Read K numbers from the string s into x[], returning a pointer to the
+ * character after the last, or NULL if there aren't enough */
+
+char *read_numbers(char *s, int K, double *x)
+{
+  int r;
+  char *end;
+
+  for (r=0; r<K; r++) {
+    x[r] = strtod(s,&end);
+    if (end==s) return NULL;
+    s = end;
+  }
+  return s;
+}
+
+
+/* Read a model written by sbm_write_model().  From then on the number of
+ * groups is the model's, and sbm_run() and sbm_update() keep its
+ * parameters fixed and calculate only the marginals and messages, by BP,
+ * which is called scoring the network with the model.  The mixing
+ * parameters are scaled to the size of the network.  Metadata values the
+ * model doesn't have get priors equal to the fractions of the model's
+ * vertices in each group.  A NULL filename drops the model.  Returns zero
+ * on success. */
+
+int sbm_read_model(SBM *sbm, char *filename)
+{
+  int K=0,n=-1,i=0,r=0;
+  int j,count;
+  ssize_t length;
+  size_t space=0;
+  double total=0.0;
+  char *line=NULL;
+  char *s,*end;
+  MODEL *model;
+  FILE *stream;
+
+  free_model(sbm);
+  free_results(sbm);
+  if (filename==NULL) return 0;
+  stream = fopen(filename,"r");
+  if (stream==NULL) {
+    fprintf(stderr,"Can't open %s\n",filename);
+    return 1;
+  }
+  model = calloc(1,sizeof(MODEL));
+  sbm->model = model;
+
+  while ((length=getline(&line,&space,stream))!=-1) {
+    if ((length>0)&&(line[length-1]=='\n')) line[--length] = '\0';
+    if ((length==0)||(line[0]=='#')) continue;
+    if (K==0) {
+      if ((sscanf(line,"groups %i",&K)!=1)||(K<1)) break;
+      model->K = K;
+      model->c = malloc(K*K*sizeof(double));
+      model->prior = calloc(K,sizeof(double));
+    } else if (n<0) {
+      if ((sscanf(line,"values %i",&n)!=1)||(n<0)) break;
+      model->value = malloc(n*sizeof(MVALUE));
+      model->gmma = malloc(K*n*sizeof(double));
+    } else if (r<K) {
+      if (read_numbers(line,K,model->c+K*r)==NULL) break;
+      r++;
+    } else if (i<n) {
+
+      // The count, the gammas, then the label, which is the rest of the
+      // line after one space
+
+      count = strtol(line,&end,10);
+      s = read_numbers(end,K,model->gmma+K*i);
+      if ((end==line)||(s==NULL)) break;
+      if (*s==' ') s++;
+      model->value[i].label = strdup(s);
+      model->value[i].gmma = model->gmma + K*i;
+      for (j=0; j<K; j++) model->prior[j] += count*model->value[i].gmma[j];
+      total += count;
+      model->nvalues = ++i;
+    } else break;
+  }
+  free(line);
+  fclose(stream);
+
+  if ((length!=-1)||(K==0)||(n<0)||(r<K)||(i<n)) {
+    fprintf(stderr,"Bad model file %s\n",filename);
+    free_model(sbm);
+    return 1;
+  }
+  for (r=0; r<K; r++) {
+    model->prior[r] = (total>0.0) ? model->prior[r]/total : 1.0/K;
+  }
+  qsort(model->value,n,sizeof(MVALUE),cmpvalue);
+  sbm->K = K;
+
+  return 0;
+}
+
+
+/* Functions to get the metadata.  These are available once sbm_run() has
+ * been called */
+
+int sbm_nvalues(SBM *sbm)
+{
+  return sbm->ready ? sbm->nmlabels : 0;
+}
+
+int sbm_value(SBM *sbm, int u)
+{
+  return sbm->x[renumbered(sbm,u)];
+}
+
+const char *sbm_value_label(SBM *sbm, int i)
+{
+  return sbm->mlabel[i];
+}
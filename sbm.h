@@ -0,0 +1,177 @@
+// Header file for the library that performs EM/BP community detection with
+// metadata using the degree-corrected SBM
+//
+// To use, make a context with sbm_new(), give it a network with one of the
+// sbm_read functions, set the options, call sbm_run(), and then read off
+// the results.  All the state of a calculation is in its context, so any
+// number of contexts can be used at once, each on its own thread.  The
+// only thing shared between them is the choice of vectorized log and exp,
+// which can be made once at the start with vecmath_init(), before any
+// contexts are used.
+
+#ifndef _SBM_H
+#define _SBM_H
+
+#include <stdio.h>
+#include "network.h"
+
+#define SBM_FLOOD 0        // BP schedules
+#define SBM_RESIDUAL 1
+
+#define SBM_DOUBLE 0       // Precisions for storing the messages
+#define SBM_FLOAT 1
+#define SBM_BFLOAT16 2
+
+#define SBM_ORDER_NONE 0   // Renumberings of the vertices, the same as the
+#define SBM_ORDER_DEGREE 1 //   REORDER_ values in reorder.h
+#define SBM_ORDER_BFS 2
+#define SBM_ORDER_RCM 3
+
+typedef struct sbm SBM;
+
+typedef struct {
+  double L;                // Log-likelihood of the best run
+  double score;            // The same less a penalty for the number of
+                           //   parameters (the Bayesian information
+                           //   criterion), for comparing different K
+  int run;                 // Which run it was
+  unsigned long seed;      // Seed it was started from
+  int emsteps;             // Number of EM steps it took
+  long updates;            // Number of message updates it made
+  long sweeps;             // Number of BP sweeps, or rounds of the residual
+                           //   schedule
+  int nfinished;           // Number of runs that finished (not abandoned)
+  long totalemsteps;       // Number of EM steps taken by all the runs
+  double tread;            // Seconds taken to read the network
+  double tmetadata;        // Seconds taken to set up the metadata and the
+                           //   blocks of work for the threads
+  double tbp;              // Seconds the best run spent in BP
+  double tparams;          // Seconds it spent calculating the parameters
+  double trun;             // Seconds taken by all the runs together
+} SBM_STATS;
+
+// Making and freeing contexts
+
+SBM *sbm_new(void);
+void sbm_free(SBM *sbm);
+
+// Reading the network and metadata.  Each returns zero on success.
+
+int sbm_read_gml(SBM *sbm, FILE *stream);
+int sbm_read_edgelist(SBM *sbm, char *edgefile, char *labelfile);
+int sbm_read_snapshot(SBM *sbm, char *filename);
+int sbm_write_snapshot(SBM *sbm, char *filename);
+void sbm_merge(SBM *sbm);
+NETWORK *sbm_network(SBM *sbm);
+
+// Options
+
+void sbm_set_groups(SBM *sbm, int k);
+void sbm_set_schedule(SBM *sbm, int schedule);
+void sbm_set_restarts(SBM *sbm, int nruns);
+void sbm_set_seed(SBM *sbm, unsigned long seed);
+void sbm_set_prune(SBM *sbm, int prune);
+void sbm_set_verbose(SBM *sbm, int verbose);
+
+// Store the messages, which take most of the memory, as SBM_DOUBLE (the
+// default), SBM_FLOAT, which halves their size, or SBM_BFLOAT16, which
+// quarters it.  All arithmetic is still done in double precision.
+
+void sbm_set_precision(SBM *sbm, int precision);
+
+// Divide the work of a single run with the flooding schedule among nprocs
+// processes, each of which works on its own part of the network on a
+// single thread, with the messages in memory they share.  The results are
+// the same as with one process.  Has no effect with several runs or the
+// residual schedule.
+
+void sbm_set_processes(SBM *sbm, int nprocs);
+
+// Renumber the vertices before the calculation so that neighbors are
+// close together in memory, which makes it faster on large networks.  The
+// orderings are SBM_ORDER_NONE (the default), SBM_ORDER_DEGREE,
+// SBM_ORDER_BFS and SBM_ORDER_RCM, described in reorder.c.  Marginals and
+// metadata values are still reported in the original order, but
+// sbm_network() returns the renumbered network once the calculation has
+// been run.
+
+void sbm_set_order(SBM *sbm, int ordering);
+
+// Keep the messages, and the network itself, in files in the given
+// directory instead of in memory, for networks too big for RAM.  The
+// operating system pages them in as needed.  NULL keeps them in memory.
+
+void sbm_set_scratch(SBM *sbm, char *dir);
+
+// Save the state of a single run (nruns = 1) to the named file at the end
+// of an EM step, at most once every interval seconds, so that it can be
+// carried on with sbm_resume() if it's interrupted.  The file is written
+// by a separate thread while the calculation continues.  A NULL filename
+// turns checkpoints off.
+
+void sbm_set_checkpoint(SBM *sbm, char *filename, double interval);
+
+// Running the calculation.  Each returns zero on success.  sbm_run()
+// starts from random values.  sbm_run_split() adds one group to the last
+// calculation and starts from its best run, with one group split in two,
+// which needs far fewer EM steps than starting from scratch.
+
+int sbm_run(SBM *sbm);
+int sbm_run_split(SBM *sbm);
+
+// Carry on a run from a checkpoint saved on the same network, with the
+// number of groups and the schedule it was saved with.  The result is the
+// same as if the run had never been interrupted.  Returns zero on success.
+
+int sbm_resume(SBM *sbm, char *filename);
+
+// Change the network after a calculation and fit it again, starting from
+// the results we have.  Queue the changes with the first four functions,
+// with vertices numbered as in the results, then make them all at once
+// with sbm_update().  This does a single run with the residual schedule,
+// which updates only the messages the changes affect, and is much faster
+// than starting again when the changes are small.  sbm_add_vertex()
+// returns the number the new vertex will have; the others return zero on
+// success.  After scoring with a model (below), new vertices with edges
+// only to the network and each other are attached without changing
+// anything else.
+
+int sbm_add_vertex(SBM *sbm, char *label);
+int sbm_add_edge(SBM *sbm, int u, int v);
+int sbm_remove_edge(SBM *sbm, int u, int v);
+int sbm_change_label(SBM *sbm, int u, char *label);
+int sbm_update(SBM *sbm);
+
+// Save the fitted parameters of the best run to a file, or read them back
+// to score networks with: after sbm_read_model(), the number of groups is
+// the model's and sbm_run() runs BP only, with the parameters fixed, to
+// find the marginals.  Metadata values the model doesn't know get the
+// model's overall group sizes as their priors.  sbm_read_model(sbm,NULL)
+// goes back to fitting.  Each returns zero on success.
+
+int sbm_write_model(SBM *sbm, char *filename);
+int sbm_read_model(SBM *sbm, char *filename);
+
+// Results of the best run
+
+int sbm_groups(SBM *sbm);
+int sbm_nvertices(SBM *sbm);
+const double *sbm_marginals(SBM *sbm);
+double sbm_omega(SBM *sbm, int r, int s);
+double sbm_gamma(SBM *sbm, int r, int i);
+void sbm_stats(SBM *sbm, SBM_STATS *stats);
+
+// Write detailed statistics of the last calculation, with the wall-clock
+// and CPU time of each phase, the peak memory use, and a record of every
+// EM step and BP sweep of the best run.  The file is JSON, or CSV with one
+// line per EM step if its name ends in ".csv".  Returns zero on success.
+
+int sbm_write_stats(SBM *sbm, char *filename);
+
+// The metadata, numbered in order of first appearance among the vertices
+
+int sbm_nvalues(SBM *sbm);
+int sbm_value(SBM *sbm, int u);
+const char *sbm_value_label(SBM *sbm, int i);
+
+#endif
@@ -0,0 +1,390 @@
+// Functions to save a network and its metadata in a binary file, and to
+// load it again without having to parse the GML
+//
+// A snapshot holds everything needed to start a calculation: the edges
+// (with their weights, reverse-edge indices, and multiplicities) in the
+// same block format used by readgml.c, the position of each vertex's
+// edges, the sorted vertex IDs and the degrees counting multiplicities,
+// and the table of distinct labels with the
+// label of each vertex.  Snapshots are loaded with mmap(), so that the
+// edges and labels are used where they lie in the file with no copying,
+// and only the array of VERTEX structs has to be built.
+//
+// The file starts with a header giving a version number, a byte order
+// marker, and a checksum of the rest of the file.  Snapshots can only be
+// read on machines with the same byte order and the same layout of EDGE
+// structs as the one they were written on.
+//
+// To use this package, #include "snapshot.h" at the head of your program
+// and then call the following:
+//
+// Function calls:
+//   int write_snapshot(char *filename, NETWORK *network)
+//     -- Writes the network, including its labels, to the named file.
+//        Returns 0 if successful.
+//   int read_snapshot(char *filename, NETWORK *network)
+//     -- Loads a network written by write_snapshot().  The edges and the
+//        label strings point into the mapped file and must not be
+//        changed.  Free the network afterwards with free_network() as
+//        usual, which also unmaps the file.  Returns 0 if successful.
+//   uint64_t checksum(char *data, int64_t length)
+//     -- The checksum used in the snapshot header, for any block of data.
+
+
+// Inclusions
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "network.h"
+
+// Constants
+
+#define MAGIC "NETSNAP"        // First 8 bytes of every snapshot
+#define VERSION 2
+#define BYTEORDER 0x01020304   // Reads differently if byte order differs
+#define ALIGN 64               // Sections start on multiples of this
+#define EDGESTART 4096         // Position of the edges, a page boundary
+#define CHUNK 65536            // Bytes per block of the checksum
+#define WRITEBLOCK 4096        // Edges written at a time
+
+// Types
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t byteorder;
+  uint32_t edgesize;           // sizeof(EDGE)
+  int32_t nvertices;
+  int32_t directed;
+  int32_t nlabels;
+  int64_t nedges;
+  int64_t edgepos;             // Positions in the file of the sections
+  int64_t offsetpos;
+  int64_t idpos;
+  int64_t multidegreepos;
+  int64_t vlabelpos;
+  int64_t labelpos;
+  int64_t length;              // Total length of the file
+  uint64_t checksum;           // Of everything after the header
+} HEADER;
+
+
+// Function to round a file position up to the next section boundary
+
+int64_t align(int64_t pos)
+{
+  return (pos+ALIGN-1)/ALIGN*ALIGN;
+}
+
+
+// Function to calculate the checksum of a block of data.  The data are
+// divided into chunks, each of which gets a Fletcher-style pair of sums
+// of 64-bit words, and the chunk sums are then combined in order.  The
+// chunks are done in parallel, but the result doesn't depend on the
+// number of threads.
+
+uint64_t checksum(char *data, int64_t length)
+{
+  int64_t c,nchunks;
+  uint64_t result;
+  uint64_t *sum;
+
+  nchunks = (length+CHUNK-1)/CHUNK;
+  sum = malloc((nchunks+1)*sizeof(uint64_t));
+
+#pragma omp parallel for schedule(static)
+  for (c=0; c<nchunks; c++) {
+    int64_t i,n;
+    uint64_t a=0,b=0,word;
+    char *p=data+c*CHUNK;
+    n = length - c*CHUNK;
+    if (n>CHUNK) n = CHUNK;
+    for (i=0; i+8<=n; i+=8) {
+      memcpy(&word,p+i,8);
+      a += word;
+      b += a;
+    }
+    if (i<n) {
+      word = 0;
+      memcpy(&word,p+i,n-i);
+      a += word;
+      b += a;
+    }
+    sum[c] = a ^ (b*0x9e3779b97f4a7c15ULL);
+  }
+
+  result = length;
+  for (c=0; c<nchunks; c++) result = (result^sum[c])*0x100000001b3ULL;
+  free(sum);
+
+  return result;
+}
+
+
+// Function to write a section of a snapshot at a given position, padding
+// with zeros from the current position.  Returns 0 if successful.
+
+int write_section(FILE *stream, int64_t pos, void *data, int64_t size)
+{
+  int64_t gap;
+  static const char zero[ALIGN]={0};
+
+  for (gap=pos-ftello(stream); gap>0; gap-=ALIGN) {
+    if (fwrite(zero,1,gap>ALIGN?ALIGN:gap,stream)<1) return 1;
+  }
+  if (size==0) return 0;
+  if (fwrite(data,1,size,stream)!=size) return 1;
+  return 0;
+}
+
+
+// Function to write a snapshot
+
+int write_snapshot(char *filename, NETWORK *network)
+{
+  int i,u;
+  long e,n;
+  int *id,*vlabel,*multidegree;
+  long *offset;
+  int64_t labelbytes;
+  char *map;
+  EDGE *block;
+  HEADER h;
+  FILE *stream;
+
+  // Work out where everything goes
+
+  labelbytes = 0;
+  for (i=0; i<network->nlabels; i++) {
+    labelbytes += strlen(network->label[i]) + 1;
+  }
+
+  memset(&h,0,sizeof(HEADER));
+  memcpy(h.magic,MAGIC,8);
+  h.version = VERSION;
+  h.byteorder = BYTEORDER;
+  h.edgesize = sizeof(EDGE);
+  h.nvertices = network->nvertices;
+  h.directed = network->directed;
+  h.nlabels = network->nlabels;
+  h.nedges = network->nedges;
+  h.edgepos = EDGESTART;
+  h.offsetpos = align(h.edgepos+h.nedges*sizeof(EDGE));
+  h.idpos = align(h.offsetpos+(h.nvertices+1)*sizeof(long));
+  h.multidegreepos = align(h.idpos+h.nvertices*sizeof(int));
+  h.vlabelpos = align(h.multidegreepos+h.nvertices*sizeof(int));
+  h.labelpos = align(h.vlabelpos+h.nvertices*sizeof(int));
+  h.length = h.labelpos + labelbytes;
+
+  stream = fopen(filename,"w+");
+  if (stream==NULL) {
+    fprintf(stderr,"Unable to open snapshot file %s\n",filename);
+    return 1;
+  }
+  if (write_section(stream,0,&h,sizeof(HEADER))) goto error;
+
+  // The edges are copied into a zeroed buffer so that the padding in
+  // the EDGE structs is written as zeros, and the file is the same every
+  // time
+
+  block = calloc(WRITEBLOCK,sizeof(EDGE));
+  for (e=0; e<network->nedges; e+=n) {
+    n = network->nedges - e;
+    if (n>WRITEBLOCK) n = WRITEBLOCK;
+    for (i=0; i<n; i++) {
+      block[i].target = network->edge[e+i].target;
+      block[i].twin = network->edge[e+i].twin;
+      block[i].parallel = network->edge[e+i].parallel;
+      block[i].multiplicity = network->edge[e+i].multiplicity;
+      block[i].weight = network->edge[e+i].weight;
+    }
+    if (write_section(stream,h.edgepos+e*sizeof(EDGE),block,
+		      n*sizeof(EDGE))) {
+      free(block);
+      goto error;
+    }
+  }
+  free(block);
+
+  // The vertices
+
+  offset = malloc((network->nvertices+1)*sizeof(long));
+  id = malloc(network->nvertices*sizeof(int));
+  vlabel = malloc(network->nvertices*sizeof(int));
+  multidegree = malloc(network->nvertices*sizeof(int));
+  for (u=0; u<network->nvertices; u++) {
+    offset[u] = network->vertex[u].offset;
+    id[u] = network->vertex[u].id;
+    vlabel[u] = network->vertex[u].label;
+    multidegree[u] = network->vertex[u].multidegree;
+  }
+  offset[network->nvertices] = network->nedges;
+  i = write_section(stream,h.offsetpos,offset,
+		    (network->nvertices+1)*sizeof(long))
+    || write_section(stream,h.idpos,id,network->nvertices*sizeof(int))
+    || write_section(stream,h.multidegreepos,multidegree,
+		     network->nvertices*sizeof(int))
+    || write_section(stream,h.vlabelpos,vlabel,
+		     network->nvertices*sizeof(int));
+  free(offset);
+  free(id);
+  free(vlabel);
+  free(multidegree);
+  if (i) goto error;
+
+  // The labels, one after another with their terminating zeros
+
+  if (write_section(stream,h.labelpos,NULL,0)) goto error;
+  for (i=0; i<network->nlabels; i++) {
+    n = strlen(network->label[i]) + 1;
+    if (fwrite(network->label[i],1,n,stream)!=n) goto error;
+  }
+  if (fflush(stream)!=0) goto error;
+
+  // Finally calculate the checksum and put it in the header
+
+  map = mmap(NULL,h.length,PROT_READ,MAP_SHARED,fileno(stream),0);
+  if (map==MAP_FAILED) goto error;
+  h.checksum = checksum(map+sizeof(HEADER),h.length-sizeof(HEADER));
+  munmap(map,h.length);
+  rewind(stream);
+  if (write_section(stream,0,&h,sizeof(HEADER))) goto error;
+  if (fclose(stream)!=0) {
+    fprintf(stderr,"Error writing snapshot file %s\n",filename);
+    return 1;
+  }
+
+  return 0;
+
+ error:
+  fprintf(stderr,"Error writing snapshot file %s\n",filename);
+  fclose(stream);
+  return 1;
+}
+
+
+// Function to read a snapshot
+
+int read_snapshot(char *filename, NETWORK *network)
+{
+  int fd;
+  int i,u;
+  long *offset;
+  int *id,*vlabel,*multidegree;
+  char **label;
+  char *map,*p;
+  HEADER *h;
+  struct stat status;
+
+  // Map the file
+
+  fd = open(filename,O_RDONLY);
+  if (fd<0) {
+    fprintf(stderr,"Unable to open snapshot file %s\n",filename);
+    return 1;
+  }
+  if ((fstat(fd,&status)!=0)||(status.st_size<sizeof(HEADER))) {
+    fprintf(stderr,"%s is not a network snapshot\n",filename);
+    close(fd);
+    return 1;
+  }
+  map = mmap(NULL,status.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  close(fd);
+  if (map==MAP_FAILED) {
+    fprintf(stderr,"Unable to map snapshot file %s\n",filename);
+    return 1;
+  }
+  h = (HEADER*)map;
+
+  // Check the header and the checksum
+
+  if (memcmp(h->magic,MAGIC,8)!=0) {
+    fprintf(stderr,"%s is not a network snapshot\n",filename);
+    goto error;
+  }
+  if (h->version!=VERSION) {
+    fprintf(stderr,"Snapshot %s has version %u, but only version %i "
+	    "can be read\n",filename,h->version,VERSION);
+    goto error;
+  }
+  if ((h->byteorder!=BYTEORDER)||(h->edgesize!=sizeof(EDGE))) {
+    fprintf(stderr,"Snapshot %s was written on an incompatible machine\n",
+	    filename);
+    goto error;
+  }
+  if ((h->length!=status.st_size)||(h->nvertices<0)||(h->nlabels<0)
+      ||(h->nedges<0)||(h->labelpos>h->length)
+      ||(h->edgepos+h->nedges*sizeof(EDGE)>h->offsetpos)
+      ||(h->offsetpos+(h->nvertices+1)*sizeof(long)>h->idpos)
+      ||(h->idpos+h->nvertices*sizeof(int)>h->multidegreepos)
+      ||(h->multidegreepos+h->nvertices*sizeof(int)>h->vlabelpos)
+      ||(h->vlabelpos+h->nvertices*sizeof(int)>h->labelpos)) {
+    fprintf(stderr,"Snapshot %s is truncated or damaged\n",filename);
+    goto error;
+  }
+  if (checksum(map+sizeof(HEADER),h->length-sizeof(HEADER))!=h->checksum) {
+    fprintf(stderr,"Checksum error in snapshot %s\n",filename);
+    goto error;
+  }
+
+  // Find the labels
+
+  label = malloc(h->nlabels*sizeof(char*));
+  p = map + h->labelpos;
+  for (i=0; i<h->nlabels; i++) {
+    label[i] = p;
+    p = memchr(p,'\0',map+h->length-p);
+    if (p==NULL) {
+      fprintf(stderr,"Snapshot %s is truncated or damaged\n",filename);
+      free(label);
+      goto error;
+    }
+    p++;
+  }
+
+  // Set up the network
+
+  offset = (long*)(map+h->offsetpos);
+  id = (int*)(map+h->idpos);
+  vlabel = (int*)(map+h->vlabelpos);
+  multidegree = (int*)(map+h->multidegreepos);
+  memset(network,0,sizeof(NETWORK));
+  network->nvertices = h->nvertices;
+  network->directed = h->directed;
+  network->nedges = h->nedges;
+  network->edge = (EDGE*)(map+h->edgepos);
+  network->map = map;
+  network->maplength = h->length;
+  network->nlabels = h->nlabels;
+  network->label = label;
+  network->vertex = malloc(h->nvertices*sizeof(VERTEX));
+  for (u=0; u<h->nvertices; u++) {
+    if ((offset[u]<0)||(offset[u]>offset[u+1])||(offset[u+1]>h->nedges)
+	||(vlabel[u]<0)||(vlabel[u]>=h->nlabels)) {
+      fprintf(stderr,"Snapshot %s is truncated or damaged\n",filename);
+      free(network->vertex);
+      free(label);
+      goto error;
+    }
+    network->vertex[u].id = id[u];
+    network->vertex[u].degree = offset[u+1] - offset[u];
+    network->vertex[u].multidegree = multidegree[u];
+    network->vertex[u].label = vlabel[u];
+    network->vertex[u].offset = offset[u];
+    network->vertex[u].edge = network->edge + offset[u];
+  }
+
+  return 0;
+
+ error:
+  munmap(map,status.st_size);
+  return 1;
+}
@@ -0,0 +1,13 @@
+// Header file for binary network snapshots
+
+#ifndef _SNAPSHOT_H
+#define _SNAPSHOT_H
+
+#include <stdint.h>
+#include "network.h"
+
+int write_snapshot(char *filename, NETWORK *network);
+int read_snapshot(char *filename, NETWORK *network);
+uint64_t checksum(char *data, int64_t length);
+
+#endif
@@ -0,0 +1,203 @@
+// Vectorized versions of exp() and log() for arrays of doubles
+//
+// Written for the BP and EM loops in metadata.c, which spend most of their
+// time taking logs and exponentials.  There are versions for AVX2 and
+// AVX-512, which are used if the processor supports them, and a scalar
+// version that simply calls the C library.  The vectorized versions agree
+// with the C library to within a relative difference of VM_TOLERANCE,
+// which vecmath_check() verifies.
+//
+// Function calls:
+//   int vecmath_init(int level)
+//     -- Chooses which version to use: VM_SCALAR, VM_AVX2, or VM_AVX512,
+//        or VM_AUTO for the best the processor supports.  If the processor
+//        doesn't support the one asked for, the best one that it does
+//        support is used instead.  Returns the one chosen.
+//   void vexp(long n, const double *x, double *y)
+//   void vlog(long n, const double *x, double *y)
+//     -- Set y[i] to exp(x[i]) or log(x[i]) for i=0...n-1.  x and y may be
+//        the same array.
+//   const char *vecmath_name(int level)
+//     -- Returns the name of a version, for printing
+//   double vecmath_check()
+//     -- Compares the chosen version with the C library over a wide range
+//        of arguments and returns the largest relative difference
+
+
+// Inclusions
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#include "vecmath.h"
+
+// Constants
+
+#define VM_LOG2E 1.44269504088896338700e+00
+#define VM_LN2HI 6.93147180369123816490e-01   // log(2) in two parts
+#define VM_LN2LO 1.90821492927058770002e-10
+#define VM_SQRT2 1.41421356237309504880
+#define VM_MAGIC 6755399441055744.0           // 1.5 * 2^52
+#define VM_TWO52 4503599627370496.0           // 2^52
+#define VM_DBLMIN DBL_MIN
+#define VM_EXPMAX 709.782712893384            // exp() overflows above this
+#define VM_EXPMIN -745.1332191019412          // and underflows below this
+
+
+// Scalar versions
+
+static void vexp_scalar(long n, const double *x, double *y)
+{
+  long i;
+
+  for (i=0; i<n; i++) y[i] = exp(x[i]);
+}
+
+static void vlog_scalar(long n, const double *x, double *y)
+{
+  long i;
+
+  for (i=0; i<n; i++) y[i] = log(x[i]);
+}
+
+
+// Vectorized versions
+
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#define VW 4
+#define SUFFIX avx2
+#include "vecmath_kernels.h"
+#undef VW
+#undef SUFFIX
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,fma")
+#define VW 8
+#define SUFFIX avx512
+#include "vecmath_kernels.h"
+#undef VW
+#undef SUFFIX
+#pragma GCC pop_options
+
+
+// Globals
+
+void (*vexp)(long n, const double *x, double *y) = vexp_scalar;
+void (*vlog)(long n, const double *x, double *y) = vlog_scalar;
+
+
+// Function to choose the version to use
+
+int vecmath_init(int level)
+{
+  int best;
+
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")&&__builtin_cpu_supports("fma")) {
+    best = VM_AVX512;
+  } else if (__builtin_cpu_supports("avx2")&&__builtin_cpu_supports("fma")) {
+    best = VM_AVX2;
+  } else best = VM_SCALAR;
+  if ((level==VM_AUTO)||(level>best)) level = best;
+
+  switch (level) {
+  case VM_AVX512:
+    vexp = vexp_avx512;
+    vlog = vlog_avx512;
+    break;
+  case VM_AVX2:
+    vexp = vexp_avx2;
+    vlog = vlog_avx2;
+    break;
+  default:
+    level = VM_SCALAR;
+    vexp = vexp_scalar;
+    vlog = vlog_scalar;
+  }
+
+  return level;
+}
+
+
+// Function to return the name of a version
+
+const char *vecmath_name(int level)
+{
+  switch (level) {
+  case VM_AVX512: return "avx512";
+  case VM_AVX2: return "avx2";
+  default: return "scalar";
+  }
+}
+
+
+// Function to compare the chosen version with the C library.  Uses
+// arguments spread evenly over the whole range in which the functions
+// give normal, finite results, plus the special cases, and returns the
+// largest relative difference (or HUGE_VAL if a special case disagrees).
+
+#define NCHECK 100000
+
+double vecmath_check(void)
+{
+  int i;
+  double diff,maxdiff;
+  double *x,*y;
+  static const double special[] = { 0.0, -0.0, 1.0, -1.0, HUGE_VAL,
+				     -HUGE_VAL, NAN, 1000.0, -1000.0,
+				     DBL_MIN, DBL_TRUE_MIN };
+  int nspecial=sizeof(special)/sizeof(double);
+
+  x = malloc(NCHECK*sizeof(double));
+  y = malloc(NCHECK*sizeof(double));
+  maxdiff = 0.0;
+
+  // exp() over its normal range
+
+  for (i=0; i<NCHECK; i++) x[i] = -708.0 + 1417.0*i/NCHECK;
+  vexp(NCHECK,x,y);
+  for (i=0; i<NCHECK; i++) {
+    diff = fabs(y[i]-exp(x[i]))/exp(x[i]);
+    if (diff>maxdiff) maxdiff = diff;
+  }
+
+  // log() over all normal positive doubles
+
+  for (i=0; i<NCHECK; i++) x[i] = exp(-708.0 + 1417.0*i/NCHECK);
+  vlog(NCHECK,x,y);
+  for (i=0; i<NCHECK; i++) {
+    diff = fabs(y[i]-log(x[i]));
+    if (log(x[i])!=0.0) diff /= fabs(log(x[i]));
+    if (diff>maxdiff) maxdiff = diff;
+  }
+
+  // Special cases, which must agree exactly
+
+  vexp(nspecial,special,y);
+  for (i=0; i<nspecial; i++) {
+    if ((y[i]!=exp(special[i]))&&!(isnan(y[i])&&isnan(exp(special[i])))) {
+      maxdiff = HUGE_VAL;
+    }
+  }
+  vlog(nspecial,special,y);
+  for (i=0; i<nspecial; i++) {
+    if (isinf(log(special[i]))||isnan(log(special[i]))) {
+      if ((y[i]!=log(special[i]))&&!(isnan(y[i])&&isnan(log(special[i])))) {
+	maxdiff = HUGE_VAL;
+      }
+    } else {
+      diff = fabs(y[i]-log(special[i]));
+      if (log(special[i])!=0.0) diff /= fabs(log(special[i]));
+      if (diff>maxdiff) maxdiff = diff;
+    }
+  }
+
+  free(x);
+  free(y);
+
+  return maxdiff;
+}
@@ -0,0 +1,24 @@
+// Header file for the vectorized exp() and log() functions
+//
+// To use, call vecmath_init() once, then call vexp() and vlog() to
+// calculate exponentials and logarithms of whole arrays at a time.
+
+#ifndef _VECMATH_H
+#define _VECMATH_H
+
+#define VM_AUTO -1         // Instruction sets, in order of preference
+#define VM_SCALAR 0
+#define VM_AVX2 1
+#define VM_AVX512 2
+
+#define VM_TOLERANCE 1e-14 // Largest relative difference allowed between
+                           // the vectorized functions and the C library
+
+extern void (*vexp)(long n, const double *x, double *y);
+extern void (*vlog)(long n, const double *x, double *y);
+
+int vecmath_init(int level);
+const char *vecmath_name(int level);
+double vecmath_check(void);
+
+#endif
@@ -0,0 +1,178 @@
+// Vectorized exp() and log() for vectors of VW doubles, written with the
+// GCC vector extensions
+//
+// This file is included by vecmath.c once for each instruction set, with
+// VW set to the vector width in doubles, SUFFIX to a name for the
+// instruction set, and the matching target options in force.  It defines
+// vexp_SUFFIX() and vlog_SUFFIX(), which work on arrays of any length.
+//
+// exp(x) is calculated by writing x = n log 2 + r with |r| <= log(2)/2,
+// using a Taylor series to degree 13 for exp(r), and multiplying by 2^n in
+// two halves so that results in the subnormal range come out right.
+// log(x) is calculated by writing x = 2^n m with sqrt(1/2) < m <= sqrt(2)
+// and using the series log(m) = 2 atanh(f) = 2(f + f^3/3 + ... + f^21/21),
+// with f = (m-1)/(m+1).  Both agree with the C library to within a few
+// units in the last place, and both handle infinities, NaNs, zero, and
+// arguments that over- or underflow the way the C library does.
+
+#define CAT2(a,b) a##b
+#define CAT(a,b) CAT2(a,b)
+#define VD CAT(vd_,SUFFIX)
+#define VL CAT(vl_,SUFFIX)
+#define SELECT CAT(select_,SUFFIX)
+#define EXP1 CAT(exp1_,SUFFIX)
+#define LOG1 CAT(log1_,SUFFIX)
+
+typedef double VD __attribute__((vector_size(8*VW)));
+typedef long VL __attribute__((vector_size(8*VW)));
+
+
+// Function to choose elements from a where mask is set and b otherwise
+
+static inline VD SELECT(VL mask, VD a, VD b)
+{
+  return (VD)(((VL)a&mask)|((VL)b&~mask));
+}
+
+
+// Function to calculate exp() of one vector
+
+static inline VD EXP1(VD x)
+{
+  VL nan,big,small,ni,n1,n2;
+  VD t,n,r,p,xc,zero=(VD)((VL)x&0);
+
+  nan = x!=x;
+  big = x>VM_EXPMAX;
+  small = x<VM_EXPMIN;
+  xc = SELECT(big|small|nan,zero,x);
+
+  // Write x = n log 2 + r
+
+  t = xc*VM_LOG2E + VM_MAGIC;
+  n = t - VM_MAGIC;
+  r = (xc-n*VM_LN2HI) - n*VM_LN2LO;
+  ni = (VL)t - (VL)(zero+VM_MAGIC);
+
+  // Taylor series for exp(r)
+
+  p = zero + 1.0/6227020800.0;
+  p = p*r + 1.0/479001600.0;
+  p = p*r + 1.0/39916800.0;
+  p = p*r + 1.0/3628800.0;
+  p = p*r + 1.0/362880.0;
+  p = p*r + 1.0/40320.0;
+  p = p*r + 1.0/5040.0;
+  p = p*r + 1.0/720.0;
+  p = p*r + 1.0/120.0;
+  p = p*r + 1.0/24.0;
+  p = p*r + 1.0/6.0;
+  p = p*r + 0.5;
+  p = p*r + 1.0;
+  p = p*r + 1.0;
+
+  // Multiply by 2^n
+
+  n1 = ni>>1;
+  n2 = ni - n1;
+  p = p*(VD)((n1+1023)<<52);
+  p = p*(VD)((n2+1023)<<52);
+
+  p = SELECT(big,zero+HUGE_VAL,p);
+  p = SELECT(small,zero,p);
+  return SELECT(nan,x,p);
+}
+
+
+// Function to calculate log() of one vector
+
+static inline VD LOG1(VD x)
+{
+  VL bits,e,sub,big;
+  VD m,f,f2,p,ed,y,zero=(VD)((VL)x&0);
+
+  // Scale up subnormal arguments
+
+  sub = (x>0.0)&(x<VM_DBLMIN);
+  x = SELECT(sub,x*VM_TWO52,x);
+
+  // Write x = 2^e m with m in [1,2), then move m into (sqrt(1/2),sqrt(2)]
+
+  bits = (VL)x;
+  e = ((bits>>52)&0x7ff) - 1023 + (sub&-52);
+  m = (VD)((bits&0x000fffffffffffffL)|0x3ff0000000000000L);
+  big = m>VM_SQRT2;
+  m = SELECT(big,m*0.5,m);
+  e = e - big;
+  ed = (VD)(e+(VL)(zero+VM_MAGIC)) - VM_MAGIC;
+
+  // Series for log(m)
+
+  f = (m-1.0)/(m+1.0);
+  f2 = f*f;
+  p = zero + 1.0/21.0;
+  p = p*f2 + 1.0/19.0;
+  p = p*f2 + 1.0/17.0;
+  p = p*f2 + 1.0/15.0;
+  p = p*f2 + 1.0/13.0;
+  p = p*f2 + 1.0/11.0;
+  p = p*f2 + 1.0/9.0;
+  p = p*f2 + 1.0/7.0;
+  p = p*f2 + 1.0/5.0;
+  p = p*f2 + 1.0/3.0;
+  p = p*f2;
+  y = ed*VM_LN2HI + (2.0*f + (2.0*f*p + ed*VM_LN2LO));
+
+  // Special cases
+
+  y = SELECT(x==HUGE_VAL,x,y);
+  y = SELECT(x==0.0,zero-HUGE_VAL,y);
+  return SELECT((x<0.0)|(x!=x),zero+NAN,y);
+}
+
+
+// Functions to calculate exp() and log() of arrays of n values.  Any
+// leftover values at the end are padded out to a full vector, so every
+// value goes through the same calculation.
+
+static void CAT(vexp_,SUFFIX)(long n, const double *x, double *y)
+{
+  long i;
+  VD v;
+
+  for (i=0; i+VW<=n; i+=VW) {
+    memcpy(&v,x+i,sizeof(VD));
+    v = EXP1(v);
+    memcpy(y+i,&v,sizeof(VD));
+  }
+  if (i<n) {
+    memset(&v,0,sizeof(VD));
+    memcpy(&v,x+i,(n-i)*sizeof(double));
+    v = EXP1(v);
+    memcpy(y+i,&v,(n-i)*sizeof(double));
+  }
+}
+
+static void CAT(vlog_,SUFFIX)(long n, const double *x, double *y)
+{
+  long i;
+  VD v;
+
+  for (i=0; i+VW<=n; i+=VW) {
+    memcpy(&v,x+i,sizeof(VD));
+    v = LOG1(v);
+    memcpy(y+i,&v,sizeof(VD));
+  }
+  if (i<n) {
+    memset(&v,0,sizeof(VD));
+    memcpy(&v,x+i,(n-i)*sizeof(double));
+    v = LOG1(v);
+    memcpy(y+i,&v,(n-i)*sizeof(double));
+  }
+}
+
+#undef VD
+#undef VL
+#undef SELECT
+#undef EXP1
+#undef LOG1